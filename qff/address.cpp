@@ -1,6 +1,9 @@
 #include "address.h"
 
 #include "log.h"
+#include "dns.h"
+#include "hook.h"
+#include "io_manager.h"
 
 #include <sstream>
 #include <netdb.h>
@@ -8,6 +11,7 @@
 #include <stddef.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <type_traits>
 
 namespace qff {
 
@@ -83,6 +87,25 @@ std::vector<Address::ptr> Address::Lookup(std::string_view host, int family, int
         node = host;
     }
 
+    //on a hooked worker the resolver parks the fiber where getaddrinfo would block the thread.
+    std::string_view port;
+    if(service)
+        port = host.substr(service - host.data());
+    if(is_hook_enable() && IOManager::GetThis()
+            && port.find_first_not_of("0123456789") == std::string_view::npos) {
+        std::vector<IPAddress::ptr> addrs;
+        if(DnsResolver::GetDefault()->resolve(node, family, addrs)) {
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "Address::Lookup resolve(" << host << ", "
+                << family << ") failed";
+            return vec_result;
+        }
+        for(auto& i : addrs) {
+            i->set_port(port.empty() ? 0 : atoi(std::string(port).c_str()));
+            vec_result.push_back(i);
+        }
+        return vec_result;
+    }
+
     int error = getaddrinfo(node.data(), service, &hints, &results);
     if(error) {
         QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "Address::Lookup getaddress(" << host << ", "
@@ -422,7 +445,7 @@ std::ostream& IPv6Address::dump(std::ostream& os) const {
         if(i) {
             os << ":";
         }
-        os << std::hex << (int)::ntohl(addr[i]) << std::dec;
+        os << std::hex << (int)::ntohs(addr[i]) << std::dec;
     }
 
     if(!used_zeros && addr[7] == 0) {
@@ -494,8 +517,218 @@ std::ostream& UnknownAddress::dump(std::ostream& os) const {
     return os;
 }
 
+static_assert(std::is_trivially_copyable<SockAddr>::value, "SockAddr must stay a plain value");
+
+//murmur3 finalizer, spreads every input bit over the whole word.
+static inline uint64_t MixHash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+//writes v in decimal, returns the digits written.
+static size_t FormatUint(char* buf, uint32_t v) {
+    char tmp[10];
+    size_t n = 0;
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    for(size_t i = 0; i < n; ++i)
+        buf[i] = tmp[n - i - 1];
+    return n;
+}
+
+SockAddr::SockAddr() noexcept {
+    memset(&m_addr, 0, sizeof(m_addr));
+    m_length = 0;
+}
+
+SockAddr::SockAddr(const sockaddr* addr, socklen_t addr_len) noexcept {
+    memset(&m_addr, 0, sizeof(m_addr));
+    m_length = addr ? std::min<socklen_t>(addr_len, sizeof(m_addr)) : 0;
+    if(m_length)
+        memcpy(&m_addr, addr, m_length);
+}
+
+SockAddr::SockAddr(const Address& addr) noexcept
+    :SockAddr(addr.get_addr(), addr.get_addr_len()) {
+}
+
+SockAddr SockAddr::FromIPv4(uint32_t address, uint16_t port) noexcept {
+    SockAddr rt;
+    rt.m_addr.in.sin_family = AF_INET;
+    rt.m_addr.in.sin_addr.s_addr = htonl(address);
+    rt.m_addr.in.sin_port = htons(port);
+    rt.m_length = sizeof(sockaddr_in);
+    return rt;
+}
+
+bool SockAddr::Parse(std::string_view text, uint16_t port, SockAddr& result) noexcept {
+    char buf[INET6_ADDRSTRLEN];
+    if(text.size() >= sizeof(buf))
+        return false;
+    memcpy(buf, text.data(), text.size());
+    buf[text.size()] = '\0';
+
+    SockAddr rt;
+    if(inet_pton(AF_INET, buf, &rt.m_addr.in.sin_addr) == 1) {
+        rt.m_addr.in.sin_family = AF_INET;
+        rt.m_length = sizeof(sockaddr_in);
+    } else if(inet_pton(AF_INET6, buf, &rt.m_addr.in6.sin6_addr) == 1) {
+        rt.m_addr.in6.sin6_family = AF_INET6;
+        rt.m_length = sizeof(sockaddr_in6);
+    } else {
+        return false;
+    }
+    rt.set_port(port);
+    result = rt;
+    return true;
+}
+
+uint16_t SockAddr::get_port() const noexcept {
+    switch(get_family()) {
+        case AF_INET:
+            return ntohs(m_addr.in.sin_port);
+        case AF_INET6:
+            return ntohs(m_addr.in6.sin6_port);
+        default:
+            return 0;
+    }
+}
+
+void SockAddr::set_port(uint16_t v) noexcept {
+    switch(get_family()) {
+        case AF_INET:
+            m_addr.in.sin_port = htons(v);
+            break;
+        case AF_INET6:
+            m_addr.in6.sin6_port = htons(v);
+            break;
+        default:
+            break;
+    }
+}
+
+size_t SockAddr::hash() const noexcept {
+    switch(get_family()) {
+        case AF_INET:
+            return MixHash(((uint64_t)AF_INET << 48)
+                    | ((uint64_t)m_addr.in.sin_addr.s_addr << 16) | m_addr.in.sin_port);
+        case AF_INET6: {
+            uint64_t words[2];
+            memcpy(words, m_addr.in6.sin6_addr.s6_addr, sizeof(words));
+            uint64_t tail = ((uint64_t)m_addr.in6.sin6_scope_id << 16) | m_addr.in6.sin6_port;
+            return MixHash(words[0] ^ MixHash(words[1] ^ MixHash(tail)));
+        }
+        default: {
+            //fnv-1a over the raw bytes, unix paths are rare on hot paths.
+            uint64_t h = 0xcbf29ce484222325ULL;
+            const unsigned char* p = (const unsigned char*)&m_addr;
+            for(socklen_t i = 0; i < m_length; ++i)
+                h = (h ^ p[i]) * 0x100000001b3ULL;
+            return MixHash(h);
+        }
+    }
+}
+
+bool SockAddr::operator==(const SockAddr& rhs) const noexcept {
+    if(get_family() != rhs.get_family())
+        return false;
+    switch(get_family()) {
+        case AF_INET:
+            return m_addr.in.sin_addr.s_addr == rhs.m_addr.in.sin_addr.s_addr
+                && m_addr.in.sin_port == rhs.m_addr.in.sin_port;
+        case AF_INET6:
+            return m_addr.in6.sin6_port == rhs.m_addr.in6.sin6_port
+                && m_addr.in6.sin6_scope_id == rhs.m_addr.in6.sin6_scope_id
+                && memcmp(&m_addr.in6.sin6_addr, &rhs.m_addr.in6.sin6_addr, sizeof(in6_addr)) == 0;
+        default:
+            return m_length == rhs.m_length && memcmp(&m_addr, &rhs.m_addr, m_length) == 0;
+    }
+}
+
+size_t SockAddr::format(char* buf, size_t size) const noexcept {
+    char tmp[MAX_STRING_LEN];
+    size_t n = 0;
+    switch(get_family()) {
+        case AF_INET: {
+            uint32_t addr = ntohl(m_addr.in.sin_addr.s_addr);
+            for(int shift = 24; shift >= 0; shift -= 8) {
+                n += FormatUint(tmp + n, (addr >> shift) & 0xff);
+                tmp[n++] = shift ? '.' : ':';
+            }
+            n += FormatUint(tmp + n, get_port());
+            break;
+        }
+        case AF_INET6:
+            tmp[n++] = '[';
+            inet_ntop(AF_INET6, &m_addr.in6.sin6_addr, tmp + n, INET6_ADDRSTRLEN);
+            n += strlen(tmp + n);
+            if(m_addr.in6.sin6_scope_id) {
+                tmp[n++] = '%';
+                n += FormatUint(tmp + n, m_addr.in6.sin6_scope_id);
+            }
+            tmp[n++] = ']';
+            tmp[n++] = ':';
+            n += FormatUint(tmp + n, get_port());
+            break;
+        case AF_UNIX: {
+            size_t length = m_length > offsetof(sockaddr_un, sun_path)
+                            ? m_length - offsetof(sockaddr_un, sun_path) : 0;
+            const char* path = m_addr.un.sun_path;
+            if(length && path[0] == '\0') {
+                //abstract names are shown the way UnixAddress shows them.
+                tmp[n++] = '\\';
+                tmp[n++] = '0';
+                memcpy(tmp + n, path + 1, length - 1);
+                n += length - 1;
+            } else {
+                length = strnlen(path, length);
+                memcpy(tmp + n, path, length);
+                n += length;
+            }
+            break;
+        }
+        default:
+            n = snprintf(tmp, sizeof(tmp), "[UnknownAddress family=%d]", get_family());
+            break;
+    }
+    if(size) {
+        size_t copy = std::min(n, size - 1);
+        memcpy(buf, tmp, copy);
+        buf[copy] = '\0';
+    }
+    return n;
+}
+
+std::string SockAddr::to_string() const {
+    char buf[MAX_STRING_LEN];
+    size_t n = format(buf, sizeof(buf));
+    return std::string(buf, std::min(n, sizeof(buf) - 1));
+}
+
+Address::ptr SockAddr::to_address() const {
+    if(get_family() == AF_UNIX) {
+        UnixAddress::ptr rt = std::make_shared<UnixAddress>();
+        memcpy((void*)rt->get_addr(), &m_addr.un, m_length);
+        rt->set_addr_len(m_length);
+        return rt;
+    }
+    return Address::Create(get_addr(), m_length);
+}
+
 std::ostream& operator<<(std::ostream& os, const Address& addr) {
     return addr.dump(os);
 }
 
+std::ostream& operator<<(std::ostream& os, const SockAddr& addr) {
+    char buf[SockAddr::MAX_STRING_LEN];
+    size_t n = addr.format(buf, sizeof(buf));
+    return os.write(buf, std::min(n, sizeof(buf) - 1));
+}
+
 } //namespace qff
\ No newline at end of file
@@ -9,6 +9,8 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <string>
+#include <functional>
 
 namespace qff {
 
@@ -121,8 +123,68 @@ private:
     sockaddr m_addr;
 };
 
+//value type for the per-packet and per-accept paths, trivially copyable and
+//never allocates. holds an ipv4, ipv6 or unix address.
+class SockAddr final {
+public:
+    //room for format(), enough for a full unix path or "[v6%scope]:port".
+    static const size_t MAX_STRING_LEN = 128;
+
+    SockAddr() noexcept;
+    //copies at most sizeof(sockaddr_un) bytes.
+    SockAddr(const sockaddr* addr, socklen_t addr_len) noexcept;
+    explicit SockAddr(const Address& addr) noexcept;
+    //address and port in host order.
+    static SockAddr FromIPv4(uint32_t address, uint16_t port) noexcept;
+    //numeric addresses only, returns false when text is neither v4 nor v6.
+    static bool Parse(std::string_view text, uint16_t port, SockAddr& result) noexcept;
+
+    int get_family() const noexcept { return m_addr.sa.sa_family;}
+    const sockaddr* get_addr() const noexcept { return &m_addr.sa;}
+    //for accept and recvfrom to fill in, set the length afterwards.
+    sockaddr* get_addr() noexcept { return &m_addr.sa;}
+    socklen_t get_addr_len() const noexcept { return m_length;}
+    void set_addr_len(socklen_t v) noexcept { m_length = v;}
+    static constexpr socklen_t GetCapacity() noexcept { return sizeof(Storage);}
+    //0 for unix addresses.
+    uint16_t get_port() const noexcept;
+    void set_port(uint16_t v) noexcept;
+
+    size_t hash() const noexcept;
+    //writes "1.2.3.4:80", "[::1]:80" or the unix path and a trailing NUL, cut to
+    //size. returns the length it wanted, like snprintf.
+    size_t format(char* buf, size_t size) const noexcept;
+    std::string to_string() const;
+    //allocates.
+    Address::ptr to_address() const;
+
+    //compare the family, address, port and v6 scope, nothing else.
+    bool operator==(const SockAddr& rhs) const noexcept;
+    bool operator!=(const SockAddr& rhs) const noexcept { return !(*this == rhs);}
+private:
+    union Storage {
+        sockaddr sa;
+        sockaddr_in in;
+        sockaddr_in6 in6;
+        sockaddr_un un;
+    };
+
+    Storage m_addr;
+    socklen_t m_length;
+};
+
 std::ostream& operator<<(std::ostream& os, const Address& addr);
+std::ostream& operator<<(std::ostream& os, const SockAddr& addr);
 
 } //namespace qff
 
+namespace std {
+
+template<>
+struct hash<qff::SockAddr> {
+    size_t operator()(const qff::SockAddr& addr) const noexcept { return addr.hash();}
+};
+
+} //namespace std
+
 #endif
\ No newline at end of file
@@ -328,6 +328,11 @@ void ByteArray::clear() noexcept {
     m_root->next = NULL;
 }
 
+void ByteArray::reset() noexcept {
+    m_position = m_size = 0;
+    m_cur = m_root;
+}
+
 void ByteArray::write(const void* buf, size_t size) {
     if(size == 0) {
         return;
@@ -398,9 +403,15 @@ void ByteArray::read(void* buf, size_t size, size_t position) const {
     }
 
     size_t npos = position % m_baseSize;
-    size_t ncap = m_cur->size - npos;
+    size_t count = position / m_baseSize;
+    Node* cur = m_root;
+    while(count > 0) {
+        cur = cur->next;
+        --count;
+    }
+
+    size_t ncap = cur->size - npos;
     size_t bpos = 0;
-    Node* cur = m_cur;
     while(size > 0) {
         if(ncap >= size) {
             memcpy((char*)buf + bpos, cur->ptr + npos, size);
@@ -550,7 +561,9 @@ uint64_t ByteArray::get_read_buffers(std::vector<iovec>& buffers, uint64_t len)
 }
 
 uint64_t ByteArray::get_read_buffers(std::vector<iovec>& buffers, uint64_t len, uint64_t position) const noexcept {
-    len = len > get_read_size() ? get_read_size() : len;
+    if(position >= m_size)
+        return 0;
+    len = len > m_size - position ? m_size - position : len;
     if(len == 0) {
         return 0;
     }
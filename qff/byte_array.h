@@ -65,6 +65,8 @@ public:
     std::string read_string_Vint();
 
     void clear() noexcept;
+    //like clear() but keeps the nodes for the next writes.
+    void reset() noexcept;
 
     void write(const void* buf, size_t size);
     void read(void* buf, size_t size);
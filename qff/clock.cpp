@@ -0,0 +1,130 @@
+#include "clock.h"
+#include "macro.h"
+
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+
+namespace qff {
+
+static std::atomic<ClockSource> s_clock_source = {ClockSource::MONOTONIC};
+static thread_local uint64_t t_cached_us = 0;
+//CLOCK_REALTIME minus the cached time, resampled about once a second.
+static thread_local int64_t t_wall_offset_us = 0;
+static thread_local uint64_t t_wall_sample_us = 0;
+
+struct TscCalibration {
+    uint64_t base_tsc = 0;
+    uint64_t base_us = 0;
+    //microseconds per tick in 32.32 fixed point.
+    uint64_t mult = 0;
+};
+static TscCalibration s_tsc;
+
+static uint64_t ReadClockUS(clockid_t clock_id) noexcept {
+    struct timespec ts;
+    ::clock_gettime(clock_id, &ts);
+    return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static bool HasInvariantTsc() noexcept {
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+        return false;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return edx & (1 << 8);
+}
+
+static bool CalibrateTsc() noexcept {
+    if(s_tsc.mult)
+        return true;
+    if(!HasInvariantTsc())
+        return false;
+
+    //spin rather than sleep, sleep may be hooked on a fiber.
+    uint64_t start_us = ReadClockUS(CLOCK_MONOTONIC);
+    uint64_t start_tsc = __rdtsc();
+    uint64_t end_us;
+    do {
+        end_us = ReadClockUS(CLOCK_MONOTONIC);
+    } while(end_us - start_us < 50 * 1000);
+    uint64_t end_tsc = __rdtsc();
+    if(end_tsc <= start_tsc)
+        return false;
+
+    s_tsc.mult = ((end_us - start_us) << 32) / (end_tsc - start_tsc);
+    s_tsc.base_tsc = end_tsc;
+    s_tsc.base_us = end_us;
+    return s_tsc.mult != 0;
+}
+
+static uint64_t ReadTscUS() noexcept {
+    uint64_t delta = __rdtsc() - s_tsc.base_tsc;
+    return s_tsc.base_us + (uint64_t)(((unsigned __int128)delta * s_tsc.mult) >> 32);
+}
+#else
+static bool CalibrateTsc() noexcept {
+    return false;
+}
+
+static uint64_t ReadTscUS() noexcept {
+    return ReadClockUS(CLOCK_MONOTONIC);
+}
+#endif
+
+bool SetClockSource(ClockSource source) noexcept {
+    if(source == ClockSource::TSC && !CalibrateTsc())
+        return false;
+    s_clock_source.store(source);
+    return true;
+}
+
+ClockSource GetClockSource() noexcept {
+    return s_clock_source.load(std::memory_order_relaxed);
+}
+
+uint64_t GetMonotonicUS() noexcept {
+    switch(s_clock_source.load(std::memory_order_relaxed)) {
+        case ClockSource::MONOTONIC_COARSE:
+            return ReadClockUS(CLOCK_MONOTONIC_COARSE);
+        case ClockSource::TSC:
+            return ReadTscUS();
+        default:
+            return ReadClockUS(CLOCK_MONOTONIC);
+    }
+}
+
+uint64_t GetMonotonicMS() noexcept {
+    return GetMonotonicUS() / 1000;
+}
+
+uint64_t UpdateCachedClock() noexcept {
+    t_cached_us = GetMonotonicUS();
+    if(UNLIKELY(t_cached_us - t_wall_sample_us >= 1000 * 1000)) {
+        t_wall_offset_us = ReadClockUS(CLOCK_REALTIME) - t_cached_us;
+        t_wall_sample_us = t_cached_us;
+    }
+    return t_cached_us;
+}
+
+uint64_t GetCachedUS() noexcept {
+    if(!t_cached_us)
+        return GetMonotonicUS();
+    return t_cached_us;
+}
+
+uint64_t GetCachedMS() noexcept {
+    return GetCachedUS() / 1000;
+}
+
+time_t GetCachedWallTime() noexcept {
+    //follows wall clock steps within a second of cached refreshes.
+    if(!t_cached_us)
+        return ::time(nullptr);
+    return (t_cached_us + t_wall_offset_us) / (1000 * 1000);
+}
+
+} // namespace qff
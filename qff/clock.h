@@ -0,0 +1,36 @@
+#ifndef __QFF_CLOCK_H__
+#define __QFF_CLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+
+namespace qff {
+
+enum class ClockSource {
+    MONOTONIC,
+    //jiffy resolution, cheapest to read.
+    MONOTONIC_COARSE,
+    //invariant tsc calibrated against CLOCK_MONOTONIC, x86 only.
+    TSC
+};
+
+//returns false and keeps the current source if the tsc is not usable.
+bool SetClockSource(ClockSource source) noexcept;
+ClockSource GetClockSource() noexcept;
+
+//64-bit monotonic time read from the current source.
+uint64_t GetMonotonicUS() noexcept;
+uint64_t GetMonotonicMS() noexcept;
+
+//time cached per thread, IOManager workers refresh it once per loop.
+//threads that never refresh it read the clock instead.
+uint64_t UpdateCachedClock() noexcept;
+uint64_t GetCachedUS() noexcept;
+uint64_t GetCachedMS() noexcept;
+//wall clock seconds derived from the cached time, the offset to CLOCK_REALTIME
+//is resampled by the refresh about once a second.
+time_t GetCachedWallTime() noexcept;
+
+} // namespace qff
+
+#endif
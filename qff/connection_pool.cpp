@@ -0,0 +1,215 @@
+#include "connection_pool.h"
+#include "hook.h"
+#include "clock.h"
+#include "log.h"
+
+#include <string.h>
+
+namespace qff {
+
+//a checkout parked on an exhausted host, kept on the waiting fiber's stack.
+struct ConnectionPool::Waiter : public FiberWaiter {
+    //woken without a socket hands over the slot of a closed connection.
+    Socket::ptr sock;
+};
+
+ConnectionPool::ConnectionPool(IOManager* iom)
+    :ConnectionPool(iom, Options()) {
+}
+
+ConnectionPool::ConnectionPool(IOManager* iom, const Options& options)
+    :m_iom(iom)
+    ,m_options(options) {
+    m_options.max_active = std::max<size_t>(m_options.max_active, 1);
+}
+
+ConnectionPool::~ConnectionPool() noexcept {
+    if(m_evict_timer)
+        m_evict_timer.cancel();
+    for(auto& i : m_hosts) {
+        for(auto& j : i.second->idle)
+            j.sock->close();
+        delete i.second;
+    }
+}
+
+Socket::ptr ConnectionPool::checkout(Address::ptr address) {
+    this->start_evictor();
+    Host* host;
+    Socket::ptr sock;
+    Waiter waiter;
+    {
+        MutexType::Lock lock(m_mutex);
+        host = this->get_host(address);
+        if(!host->idle.empty()) {
+            sock = std::move(host->idle.back().sock);
+            host->idle.pop_back();
+            ++host->active;
+        } else if(host->active < m_options.max_active) {
+            ++host->active;
+        } else {
+            waiter.park(host->waiters, m_mutex);
+            ++m_metrics.waits;
+        }
+    }
+    if(waiter.is_parked()) {
+        if(this->wait(&waiter))
+            return nullptr;
+        sock = std::move(waiter.sock);
+    }
+
+    //from here on the checkout holds one of the host's active slots.
+    if(sock) {
+        bool healthy = IsHealthy(sock);
+        {
+            MutexType::Lock lock(m_mutex);
+            ++(healthy ? m_metrics.hits : m_metrics.broken);
+        }
+        if(healthy)
+            return sock;
+        sock->close();
+    }
+
+    sock = std::make_shared<Socket>(address->get_family(), Socket::TCP);
+    if(sock->connect(address, m_options.connect_timeout_ms) == 0) {
+        MutexType::Lock lock(m_mutex);
+        ++m_metrics.misses;
+        return sock;
+    }
+    int error = errno;
+    Fiber::ptr fiber;
+    {
+        MutexType::Lock lock(m_mutex);
+        ++m_metrics.connect_failures;
+        fiber = this->release_slot(host);
+    }
+    if(fiber)
+        m_iom->schedule(fiber);
+    errno = error;
+    return nullptr;
+}
+
+void ConnectionPool::checkin(Socket::ptr sock, bool broken) {
+    Address::ptr address = sock->get_remote_address();
+    broken = broken || !sock->is_connected();
+    Fiber::ptr fiber;
+    {
+        MutexType::Lock lock(m_mutex);
+        auto it = m_hosts.find(address);
+        if(it == m_hosts.end()) {
+            lock.unlock();
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "ConnectionPool checkin " << sock->to_string()
+                << " was not checked out from this pool";
+            sock->close();
+            return;
+        }
+        Host* host = it->second;
+        if(!broken && !host->waiters.empty()) {
+            Waiter* waiter = static_cast<Waiter*>(host->waiters.front());
+            waiter->sock = std::move(sock);
+            fiber = waiter->wake();
+        } else if(!broken && host->idle.size() < m_options.max_idle) {
+            host->idle.push_back({std::move(sock), GetMonotonicMS()});
+            --host->active;
+        } else {
+            fiber = this->release_slot(host);
+        }
+    }
+    if(fiber)
+        m_iom->schedule(fiber);
+    if(sock)
+        sock->close();
+}
+
+ConnectionPool::Metrics ConnectionPool::get_metrics() {
+    MutexType::Lock lock(m_mutex);
+    Metrics rt = m_metrics;
+    for(auto& i : m_hosts) {
+        rt.active += i.second->active;
+        rt.idle += i.second->idle.size();
+    }
+    if(rt.hits + rt.misses)
+        rt.hit_rate = (double)rt.hits / (rt.hits + rt.misses);
+    return rt;
+}
+
+ConnectionPool::Host* ConnectionPool::get_host(const Address::ptr& address) {
+    auto it = m_hosts.find(address);
+    if(it != m_hosts.end())
+        return it->second;
+    Host* host = new Host;
+    m_hosts.emplace(address, host);
+    return host;
+}
+
+Fiber::ptr ConnectionPool::release_slot(Host* host) {
+    if(host->waiters.empty()) {
+        --host->active;
+        return nullptr;
+    }
+    return host->waiters.front()->wake();
+}
+
+int ConnectionPool::wait(Waiter* waiter) {
+    uint64_t start = GetMonotonicUS();
+    bool woken = waiter->wait(m_iom, m_options.wait_timeout_ms);
+    m_wait_us.record(GetMonotonicUS() - start);
+    if(!woken) {
+        {
+            MutexType::Lock lock(m_mutex);
+            ++m_metrics.wait_timeouts;
+        }
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+void ConnectionPool::start_evictor() {
+    if(!m_options.idle_timeout_ms || m_evictor_started.load(std::memory_order_relaxed)
+            || m_evictor_started.exchange(true))
+        return;
+    std::weak_ptr<ConnectionPool> weak = weak_from_this();
+    if(weak.expired()) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "ConnectionPool is not owned by a shared_ptr,"
+            " idle connections are not evicted";
+        return;
+    }
+    m_evict_timer = m_iom->add_timer_handle(std::max<uint64_t>(m_options.idle_timeout_ms / 2, 1),
+                        [weak]{
+                            if(auto pool = weak.lock())
+                                pool->evict_idle();
+                        }, true);
+}
+
+void ConnectionPool::evict_idle() {
+    std::vector<Socket::ptr> expired;
+    uint64_t now = GetMonotonicMS();
+    {
+        MutexType::Lock lock(m_mutex);
+        for(auto& i : m_hosts) {
+            auto& idle = i.second->idle;
+            size_t count = 0;
+            while(count < idle.size() && now - idle[count].since_ms >= m_options.idle_timeout_ms)
+                expired.push_back(std::move(idle[count++].sock));
+            idle.erase(idle.begin(), idle.begin() + count);
+        }
+        m_metrics.evicted += expired.size();
+    }
+    for(auto& i : expired)
+        i->close();
+}
+
+bool ConnectionPool::IsHealthy(const Socket::ptr& sock) {
+    if(!sock->is_connected())
+        return false;
+    //an idle connection has nothing to read, eof, a reset or stray bytes all rule it out.
+    char c;
+    int error = errno;
+    ssize_t rt = ::recv_f(sock->get_socket(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    bool healthy = rt == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    errno = error;
+    return healthy;
+}
+
+} // namespace qff
@@ -0,0 +1,110 @@
+#ifndef __QFF_CONNECTION_POOL_H__
+#define __QFF_CONNECTION_POOL_H__
+
+#include <memory>
+#include <map>
+#include <list>
+#include <vector>
+#include <atomic>
+
+#include "socket.h"
+#include "io_manager.h"
+#include "histogram.h"
+#include "thread.h"
+#include "fiber_waiter.h"
+
+namespace qff {
+
+//tcp connections to a handful of backends kept open between calls, keyed by Address.
+//a checkout that finds the host at max active parks its fiber until a connection
+//is checked in. create it with std::make_shared, idle eviction runs on a timer
+//that only holds a weak reference.
+class ConnectionPool final : public std::enable_shared_from_this<ConnectionPool> {
+public:
+    NONECOPYABLE(ConnectionPool);
+    typedef std::shared_ptr<ConnectionPool> ptr;
+    typedef SpinLock MutexType;
+
+    struct Options {
+        //per host.
+        size_t max_idle = 8;
+        //per host, counts checked out and connecting connections.
+        size_t max_active = 64;
+        //0 keeps idle connections until the peer closes them.
+        uint64_t idle_timeout_ms = 60 * 1000;
+        uint64_t connect_timeout_ms = 3000;
+        //how long a checkout waits on an exhausted host, -1 waits forever.
+        uint64_t wait_timeout_ms = 1000;
+    };
+
+    struct Metrics {
+        //checkouts served by an idle connection.
+        uint64_t hits = 0;
+        //checkouts that had to connect.
+        uint64_t misses = 0;
+        uint64_t connect_failures = 0;
+        //idle connections that failed the health check on checkout.
+        uint64_t broken = 0;
+        //idle connections closed by the idle timeout.
+        uint64_t evicted = 0;
+        //checkouts that parked on an exhausted host.
+        uint64_t waits = 0;
+        uint64_t wait_timeouts = 0;
+        size_t active = 0;
+        size_t idle = 0;
+        double hit_rate = 0;
+    };
+
+    ConnectionPool(IOManager* iom);
+    ConnectionPool(IOManager* iom, const Options& options);
+    ~ConnectionPool() noexcept;
+
+    //returns a connected socket or nullptr, errno is ETIMEDOUT when the wait ran out.
+    //call from a fiber with hooks enabled.
+    Socket::ptr checkout(Address::ptr address);
+    //hands the socket back, broken ones and those over max idle are closed.
+    void checkin(Socket::ptr sock, bool broken = false);
+
+    const Options& get_options() const noexcept { return m_options;}
+    Metrics get_metrics();
+    //microseconds spent parked by the checkouts that waited.
+    const Histogram& get_wait_histogram() const noexcept { return m_wait_us;}
+private:
+    struct Waiter;
+    struct Idle {
+        Socket::ptr sock;
+        uint64_t since_ms;
+    };
+    struct Host {
+        //oldest first, checkouts take the warmest from the back.
+        std::vector<Idle> idle;
+        size_t active = 0;
+        FiberWaiter::List waiters;
+    };
+    struct AddressLess {
+        bool operator()(const Address::ptr& lhs, const Address::ptr& rhs) const { return *lhs < *rhs;}
+    };
+
+    Host* get_host(const Address::ptr& address);
+    //gives the slot of a closed connection to the first waiter, locked.
+    Fiber::ptr release_slot(Host* host);
+    int wait(Waiter* waiter);
+    void start_evictor();
+    void evict_idle();
+
+    static bool IsHealthy(const Socket::ptr& sock);
+private:
+    IOManager* m_iom;
+    Options m_options;
+    std::atomic<bool> m_evictor_started = {false};
+    TimerHandle m_evict_timer;
+
+    MutexType m_mutex;
+    std::map<Address::ptr, Host*, AddressLess> m_hosts;
+    Metrics m_metrics;
+    Histogram m_wait_us;
+};
+
+} // namespace qff
+
+#endif
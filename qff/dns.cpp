@@ -0,0 +1,479 @@
+#include "dns.h"
+
+#include <arpa/inet.h>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include "socket.h"
+#include "clock.h"
+#include "utils.h"
+#include "log.h"
+
+namespace qff {
+
+static const size_t MAX_MESSAGE_SIZE = 1232;
+static const uint16_t CLASS_IN = 1;
+static const uint16_t TYPE_OPT = 41;
+static const uint32_t NEGATIVE_TTL = 30;
+
+struct DnsRecord {
+    std::string owner;
+    uint16_t type;
+    uint32_t ttl;
+    size_t rdata;
+    uint16_t rdlength;
+};
+
+static uint16_t ReadU16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t ReadU32(const uint8_t* p) {
+    return ((uint32_t)ReadU16(p) << 16) | ReadU16(p + 2);
+}
+
+static void WriteU16(std::string& out, uint16_t v) {
+    out.push_back(v >> 8);
+    out.push_back(v & 0xff);
+}
+
+static bool WriteName(std::string& out, const std::string& name) {
+    size_t begin = 0;
+    while(begin < name.size()) {
+        size_t end = name.find('.', begin);
+        if(end == std::string::npos)
+            end = name.size();
+        size_t length = end - begin;
+        if(length == 0 || length > 63)
+            return false;
+        out.push_back(length);
+        out.append(name, begin, length);
+        begin = end + 1;
+    }
+    out.push_back(0);
+    return true;
+}
+
+//decodes a possibly compressed name, pos ends up behind it in the message.
+static bool ReadName(const uint8_t* msg, size_t size, size_t& pos, std::string& name) {
+    name.clear();
+    size_t cur = pos;
+    bool jumped = false;
+    for(int jumps = 0; jumps < 64;) {
+        if(cur >= size)
+            return false;
+        uint8_t length = msg[cur];
+        if((length & 0xc0) == 0xc0) {
+            if(cur + 1 >= size)
+                return false;
+            if(!jumped)
+                pos = cur + 2;
+            jumped = true;
+            cur = ((length & 0x3f) << 8) | msg[cur + 1];
+            ++jumps;
+            continue;
+        }
+        if(length & 0xc0)
+            return false;
+        ++cur;
+        if(length == 0) {
+            if(!jumped)
+                pos = cur;
+            return true;
+        }
+        if(cur + length > size)
+            return false;
+        if(!name.empty())
+            name.push_back('.');
+        for(size_t i = 0; i < length; ++i)
+            name.push_back(::tolower(msg[cur + i]));
+        cur += length;
+    }
+    return false;
+}
+
+static std::string BuildQuery(uint16_t id, const std::string& name, uint16_t type) {
+    std::string out;
+    WriteU16(out, id);
+    //recursion desired.
+    WriteU16(out, 0x0100);
+    WriteU16(out, 1);
+    WriteU16(out, 0);
+    WriteU16(out, 0);
+    WriteU16(out, 1);
+    if(!WriteName(out, name))
+        return std::string();
+    WriteU16(out, type);
+    WriteU16(out, CLASS_IN);
+    //edns0 opt record, the class advertises our udp payload size.
+    out.push_back(0);
+    WriteU16(out, TYPE_OPT);
+    WriteU16(out, MAX_MESSAGE_SIZE);
+    WriteU16(out, 0);
+    WriteU16(out, 0);
+    WriteU16(out, 0);
+    return out;
+}
+
+static bool ReadRecords(const uint8_t* msg, size_t size, size_t& pos, size_t count, std::vector<DnsRecord>& records) {
+    for(size_t i = 0; i < count; ++i) {
+        DnsRecord record;
+        if(!ReadName(msg, size, pos, record.owner) || pos + 10 > size)
+            return false;
+        record.type = ReadU16(msg + pos);
+        uint16_t klass = ReadU16(msg + pos + 2);
+        record.ttl = ReadU32(msg + pos + 4);
+        record.rdlength = ReadU16(msg + pos + 8);
+        record.rdata = pos + 10;
+        pos = record.rdata + record.rdlength;
+        if(pos > size)
+            return false;
+        if(klass == CLASS_IN)
+            records.push_back(std::move(record));
+    }
+    return true;
+}
+
+//returns the rcode, -1 if the message is not an answer to the question.
+static int ParseResponse(const uint8_t* msg, size_t size, uint16_t id, const std::string& name
+                        , uint16_t type, std::vector<IPAddress::ptr>& addresses, uint32_t& ttl) {
+    if(size < 12 || ReadU16(msg) != id || !(msg[2] & 0x80))
+        return -1;
+    int rcode = msg[3] & 0x0f;
+    size_t qdcount = ReadU16(msg + 4);
+    size_t ancount = ReadU16(msg + 6);
+    size_t nscount = ReadU16(msg + 8);
+    if(qdcount != 1)
+        return -1;
+
+    size_t pos = 12;
+    std::string qname;
+    if(!ReadName(msg, size, pos, qname) || pos + 4 > size
+            || qname != name || ReadU16(msg + pos) != type)
+        return -1;
+    pos += 4;
+
+    std::vector<DnsRecord> answers;
+    std::vector<DnsRecord> authority;
+    if(!ReadRecords(msg, size, pos, ancount, answers)
+            || !ReadRecords(msg, size, pos, nscount, authority))
+        return -1;
+
+    //follow the cname chain, the records may come in any order.
+    std::string target = name;
+    ttl = ~0u;
+    for(size_t hops = 0; hops < answers.size(); ++hops) {
+        bool moved = false;
+        for(auto& i : answers) {
+            if(i.type != DnsResolver::CNAME || i.owner != target)
+                continue;
+            size_t rdata = i.rdata;
+            if(!ReadName(msg, size, rdata, target))
+                return -1;
+            ttl = std::min(ttl, i.ttl);
+            moved = true;
+            break;
+        }
+        if(!moved)
+            break;
+    }
+
+    for(auto& i : answers) {
+        if(i.type != type || i.owner != target)
+            continue;
+        if(type == DnsResolver::A && i.rdlength == 4) {
+            uint32_t v4;
+            memcpy(&v4, msg + i.rdata, 4);
+            addresses.push_back(std::make_shared<IPv4Address>(ntohl(v4)));
+        } else if(type == DnsResolver::AAAA && i.rdlength == 16) {
+            addresses.push_back(std::make_shared<IPv6Address>(msg + i.rdata));
+        } else {
+            continue;
+        }
+        ttl = std::min(ttl, i.ttl);
+    }
+
+    if(addresses.empty()) {
+        //negative answers live as long as the soa minimum allows.
+        ttl = NEGATIVE_TTL;
+        for(auto& i : authority) {
+            if(i.type != DnsResolver::SOA || i.rdlength < 20)
+                continue;
+            uint32_t minimum = ReadU32(msg + i.rdata + i.rdlength - 4);
+            ttl = std::min(i.ttl, minimum);
+        }
+    }
+    return rcode;
+}
+
+static uint16_t NextQueryId() {
+    static thread_local std::mt19937 s_random(std::random_device{}());
+    return s_random();
+}
+
+static IPAddress::ptr CloneAddress(const IPAddress::ptr& addr) {
+    return std::dynamic_pointer_cast<IPAddress>(Address::Create(addr->get_addr(), addr->get_addr_len()));
+}
+
+static std::string NormalizeName(std::string_view name) {
+    std::string rt = StringUtils::StringToLower(name);
+    if(!rt.empty() && rt.back() == '.')
+        rt.pop_back();
+    return rt;
+}
+
+DnsResolver::DnsResolver() noexcept {
+}
+
+DnsResolver* DnsResolver::GetDefault() {
+    static DnsResolver* s_resolver = [] {
+        DnsResolver* resolver = new DnsResolver;
+        resolver->load_resolv_conf();
+        resolver->load_hosts();
+        return resolver;
+    }();
+    return s_resolver;
+}
+
+int DnsResolver::load_resolv_conf(const std::string& path) {
+    std::ifstream ifs;
+    if(!FSUtils::OpenForRead(ifs, path, std::ios::in)) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "DnsResolver::load_resolv_conf open " << path << " failed";
+        if(m_nameservers.empty())
+            this->add_nameserver(IPAddress::Create("127.0.0.1"));
+        return -1;
+    }
+
+    std::string line;
+    while(std::getline(ifs, line)) {
+        size_t comment = line.find_first_of("#;");
+        if(comment != std::string::npos)
+            line.resize(comment);
+        std::istringstream iss(line);
+        std::string key;
+        if(!(iss >> key))
+            continue;
+        if(key == "nameserver") {
+            std::string value;
+            if(!(iss >> value))
+                continue;
+            IPAddress::ptr server = IPAddress::Create(value);
+            if(server)
+                this->add_nameserver(server);
+        } else if(key == "search" || key == "domain") {
+            m_search.clear();
+            std::string value;
+            while(iss >> value)
+                m_search.push_back(NormalizeName(value));
+        } else if(key == "options") {
+            std::string value;
+            while(iss >> value) {
+                size_t colon = value.find(':');
+                if(colon == std::string::npos)
+                    continue;
+                std::string option = value.substr(0, colon);
+                size_t number = atoi(value.c_str() + colon + 1);
+                if(option == "ndots")
+                    m_ndots = number;
+                else if(option == "timeout" && number)
+                    m_timeout = number * 1000;
+                else if(option == "attempts" && number)
+                    m_attempts = number;
+            }
+        }
+    }
+    //same fallback as glibc.
+    if(m_nameservers.empty())
+        this->add_nameserver(IPAddress::Create("127.0.0.1"));
+    return 0;
+}
+
+int DnsResolver::load_hosts(const std::string& path) {
+    std::ifstream ifs;
+    if(!FSUtils::OpenForRead(ifs, path, std::ios::in)) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "DnsResolver::load_hosts open " << path << " failed";
+        return -1;
+    }
+
+    std::string line;
+    while(std::getline(ifs, line)) {
+        size_t comment = line.find('#');
+        if(comment != std::string::npos)
+            line.resize(comment);
+        std::istringstream iss(line);
+        std::string ip;
+        if(!(iss >> ip))
+            continue;
+        IPAddress::ptr addr = IPAddress::Create(ip);
+        if(!addr)
+            continue;
+        std::string name;
+        while(iss >> name)
+            m_hosts[NormalizeName(name)].push_back(addr);
+    }
+    return 0;
+}
+
+void DnsResolver::add_nameserver(IPAddress::ptr server) {
+    if(!server)
+        return;
+    if(!server->get_port())
+        server->set_port(53);
+    m_nameservers.push_back(server);
+}
+
+void DnsResolver::clear_cache() {
+    MutexType::Lock lock(m_mutex);
+    m_cache.clear();
+}
+
+int DnsResolver::resolve(std::string_view name, int family, std::vector<IPAddress::ptr>& result) {
+    bool want_a = family == AF_INET || family == AF_UNSPEC;
+    bool want_aaaa = family == AF_INET6 || family == AF_UNSPEC;
+    if(name.empty() || (!want_a && !want_aaaa))
+        return -1;
+
+    std::string host = NormalizeName(name);
+    uint8_t buf[sizeof(in6_addr)];
+    if((want_a && ::inet_pton(AF_INET, host.c_str(), buf) == 1)
+            || (want_aaaa && ::inet_pton(AF_INET6, host.c_str(), buf) == 1)) {
+        IPAddress::ptr addr = IPAddress::Create(host);
+        if(!addr)
+            return -1;
+        result.push_back(addr);
+        return 0;
+    }
+
+    size_t old_size = result.size();
+    auto it = m_hosts.find(host);
+    if(it != m_hosts.end()) {
+        for(auto& i : it->second) {
+            int addr_family = i->get_family();
+            if((addr_family == AF_INET && want_a) || (addr_family == AF_INET6 && want_aaaa))
+                result.push_back(CloneAddress(i));
+        }
+        if(result.size() > old_size)
+            return 0;
+    }
+
+    //an absolute name skips the search list.
+    bool absolute = !name.empty() && name.back() == '.';
+    if(want_a)
+        this->query(absolute ? host + '.' : host, A, result);
+    if(want_aaaa)
+        this->query(absolute ? host + '.' : host, AAAA, result);
+    return result.size() > old_size ? 0 : -1;
+}
+
+int DnsResolver::query(const std::string& name, RecordType type, std::vector<IPAddress::ptr>& result) {
+    std::vector<std::string> candidates;
+    if(name.back() == '.') {
+        candidates.push_back(name.substr(0, name.size() - 1));
+    } else {
+        size_t dots = std::count(name.begin(), name.end(), '.');
+        if(dots >= m_ndots)
+            candidates.push_back(name);
+        for(auto& i : m_search)
+            candidates.push_back(name + '.' + i);
+        if(dots < m_ndots)
+            candidates.push_back(name);
+    }
+
+    for(auto& candidate : candidates) {
+        std::string key = std::to_string(type) + ' ' + candidate;
+        bool found = false;
+        if(this->get_cache(key, result, found)) {
+            if(found)
+                return 0;
+            continue;
+        }
+
+        CacheEntry entry;
+        bool answered = false;
+        for(size_t attempt = 0; attempt < m_attempts && !answered; ++attempt) {
+            for(auto& server : m_nameservers) {
+                if(this->query_server(server, candidate, type, entry) == 0) {
+                    answered = true;
+                    break;
+                }
+            }
+        }
+        if(!answered)
+            continue;
+
+        this->set_cache(key, entry);
+        if(!entry.addresses.empty()) {
+            for(auto& i : entry.addresses)
+                result.push_back(CloneAddress(i));
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int DnsResolver::query_server(IPAddress::ptr server, const std::string& name, RecordType type, CacheEntry& entry) {
+    uint16_t id = NextQueryId();
+    std::string request = BuildQuery(id, name, type);
+    if(request.empty())
+        return -1;
+
+    Socket sock(server->get_family(), Socket::UDP);
+    if(sock.connect(server))
+        return -1;
+    if(sock.send(request.data(), request.size()) != (int)request.size())
+        return -1;
+
+    //stray datagrams do not extend the wait.
+    uint64_t deadline = GetMonotonicMS() + m_timeout;
+    uint8_t response[MAX_MESSAGE_SIZE];
+    while(true) {
+        uint64_t now = GetMonotonicMS();
+        if(now >= deadline)
+            return -1;
+        sock.set_recv_timeout(deadline - now);
+        int rt = sock.recv(response, sizeof(response));
+        if(rt < 0)
+            return -1;
+
+        std::vector<IPAddress::ptr> addresses;
+        uint32_t ttl = 0;
+        int rcode = ParseResponse(response, rt, id, name, type, addresses, ttl);
+        if(rcode < 0)
+            continue;
+        //servfail and refused are left to the next server.
+        if(rcode != 0 && rcode != 3)
+            return -1;
+        //truncated without a usable address, there is no tcp retry and an
+        //empty answer must not be cached as a negative one.
+        if((response[2] & 0x02) && addresses.empty())
+            return -1;
+        entry.addresses.swap(addresses);
+        entry.expire_ms = GetMonotonicMS() + ttl * 1000ull;
+        return 0;
+    }
+}
+
+bool DnsResolver::get_cache(const std::string& key, std::vector<IPAddress::ptr>& result, bool& found) {
+    MutexType::Lock lock(m_mutex);
+    auto it = m_cache.find(key);
+    if(it == m_cache.end())
+        return false;
+    if(it->second.expire_ms <= GetMonotonicMS()) {
+        m_cache.erase(it);
+        return false;
+    }
+    found = !it->second.addresses.empty();
+    for(auto& i : it->second.addresses)
+        result.push_back(CloneAddress(i));
+    return true;
+}
+
+void DnsResolver::set_cache(const std::string& key, const CacheEntry& entry) {
+    if(entry.expire_ms <= GetMonotonicMS())
+        return;
+    MutexType::Lock lock(m_mutex);
+    m_cache[key] = entry;
+}
+
+} // namespace qff
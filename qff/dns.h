@@ -0,0 +1,73 @@
+#ifndef __QFF_DNS_H__
+#define __QFF_DNS_H__
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+#include "address.h"
+#include "thread.h"
+#include "macro.h"
+
+namespace qff {
+
+//stub resolver that queries the nameservers over udp through hooked sockets,
+//so a lookup on a worker parks the fiber instead of the thread.
+//answers, including negative ones, are cached for their ttl.
+class DnsResolver final {
+public:
+    NONECOPYABLE(DnsResolver);
+    typedef std::shared_ptr<DnsResolver> ptr;
+    typedef SpinLock MutexType;
+
+    enum RecordType {
+        A = 1,
+        CNAME = 5,
+        SOA = 6,
+        AAAA = 28
+    };
+
+    DnsResolver() noexcept;
+
+    //set up from /etc/resolv.conf and /etc/hosts on first use.
+    static DnsResolver* GetDefault();
+
+    //configuration is not guarded, finish it before the first resolve().
+    int load_resolv_conf(const std::string& path = "/etc/resolv.conf");
+    int load_hosts(const std::string& path = "/etc/hosts");
+    void add_nameserver(IPAddress::ptr server);
+    void set_search(const std::vector<std::string>& domains) { m_search = domains; }
+    void set_ndots(size_t ndots) noexcept { m_ndots = ndots; }
+    void set_timeout(uint64_t ms) noexcept { m_timeout = ms; }
+    void set_attempts(size_t attempts) noexcept { m_attempts = attempts; }
+    void clear_cache();
+
+    //AF_INET asks for A records, AF_INET6 for AAAA and AF_UNSPEC for both.
+    //the addresses have port 0, returns -1 if none was found.
+    int resolve(std::string_view name, int family, std::vector<IPAddress::ptr>& result);
+private:
+    struct CacheEntry {
+        std::vector<IPAddress::ptr> addresses;
+        uint64_t expire_ms = 0;
+    };
+
+    int query(const std::string& name, RecordType type, std::vector<IPAddress::ptr>& result);
+    int query_server(IPAddress::ptr server, const std::string& name, RecordType type, CacheEntry& entry);
+    bool get_cache(const std::string& key, std::vector<IPAddress::ptr>& result, bool& found);
+    void set_cache(const std::string& key, const CacheEntry& entry);
+private:
+    uint64_t m_timeout = 5000;
+    size_t m_attempts = 2;
+    size_t m_ndots = 1;
+    std::vector<IPAddress::ptr> m_nameservers;
+    std::vector<std::string> m_search;
+    std::unordered_map<std::string, std::vector<IPAddress::ptr>> m_hosts;
+    MutexType m_mutex;
+    std::unordered_map<std::string, CacheEntry> m_cache;
+};
+
+} // namespace qff
+
+#endif
@@ -4,24 +4,54 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <algorithm>
 
 #include "hook.h"
+#include "address.h"
 
 namespace qff {
-    
+
+void FdStats::reset() noexcept {
+    read_bytes.store(0, std::memory_order_relaxed);
+    write_bytes.store(0, std::memory_order_relaxed);
+    syscalls.store(0, std::memory_order_relaxed);
+    parks.store(0, std::memory_order_relaxed);
+    timeouts.store(0, std::memory_order_relaxed);
+    parked_us.store(0, std::memory_order_relaxed);
+}
+
+static void TakeSnapshot(const FdContext& ctx, FdStatsSnapshot& snapshot) {
+    snapshot.fd = ctx.fd;
+    snapshot.read_bytes = ctx.stats.read_bytes.load(std::memory_order_relaxed);
+    snapshot.write_bytes = ctx.stats.write_bytes.load(std::memory_order_relaxed);
+    snapshot.syscalls = ctx.stats.syscalls.load(std::memory_order_relaxed);
+    snapshot.parks = ctx.stats.parks.load(std::memory_order_relaxed);
+    snapshot.timeouts = ctx.stats.timeouts.load(std::memory_order_relaxed);
+    snapshot.parked_us = ctx.stats.parked_us.load(std::memory_order_relaxed);
+}
+
+static uint64_t SortKey(const FdStatsSnapshot& snapshot, FdManager::StatsOrder order) {
+    if(order == FdManager::BY_BYTES)
+        return snapshot.read_bytes + snapshot.write_bytes;
+    return snapshot.parked_us;
+}
+
 FdContext::FdContext(int fd) noexcept
     :fd(fd) {
     recv_timeout = -1;
     send_timeout = -1;
+    file_offload = false;
 
     struct stat fd_stat;
     int rt = ::fstat(fd, &fd_stat);
     if(rt) {
         is_init = false;
         is_socket = false;
+        is_file = false;
     } else {
         is_init = true;
         is_socket = S_ISSOCK(fd_stat.st_mode);
+        is_file = S_ISREG(fd_stat.st_mode) || S_ISBLK(fd_stat.st_mode);
     }
 
     if(is_socket) {
@@ -38,23 +68,21 @@ FdManager::FdManager() {
 }
 
 FdContext::ptr FdManager::add_or_get_fdctx(int fd, bool auto_create) {
-    RWMutexType::ReadLock lock(m_mutex);
-
-    if(m_datas.size() <= (size_t)fd) {
-        if(!auto_create)
-            return nullptr;
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-
-        m_datas.resize(m_datas.size() * 1.5);
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        if(m_datas.size() <= (size_t)fd) {
+            if(!auto_create)
+                return nullptr;
+        } else if(m_datas[fd])
+            return m_datas[fd];
     }
-    
-    if(m_datas[fd])
-        return m_datas[fd];
 
-    FdContext::ptr ctx = std::make_shared<FdContext>(fd);
-    m_datas[fd] = ctx;
-    return ctx;
+    RWMutexType::WriteLock lock(m_mutex);
+    if(m_datas.size() <= (size_t)fd)
+        m_datas.resize(std::max(m_datas.size() * 1.5, fd * 1.5));
+    if(!m_datas[fd])
+        m_datas[fd] = std::make_shared<FdContext>(fd);
+    return m_datas[fd];
 }
 
 void FdManager::del_fdctx(int fd) noexcept {
@@ -64,4 +92,55 @@ void FdManager::del_fdctx(int fd) noexcept {
     m_datas[fd].reset();
 }
 
+std::vector<FdStatsSnapshot> FdManager::get_top_stats(size_t n, StatsOrder order) {
+    std::vector<FdStatsSnapshot> rt;
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        for(auto& i : m_datas) {
+            if(!i || !i->is_init)
+                continue;
+            rt.emplace_back();
+            TakeSnapshot(*i, rt.back());
+        }
+    }
+
+    auto greater = [order](const FdStatsSnapshot& a, const FdStatsSnapshot& b) {
+        return SortKey(a, order) > SortKey(b, order);
+    };
+    if(rt.size() > n) {
+        std::partial_sort(rt.begin(), rt.begin() + n, rt.end(), greater);
+        rt.resize(n);
+    } else
+        std::sort(rt.begin(), rt.end(), greater);
+    return rt;
+}
+
+std::ostream& FdManager::dump_top_stats(std::ostream& os, size_t n, StatsOrder order) {
+    for(auto& i : get_top_stats(n, order)) {
+        os << "fd=" << i.fd;
+        sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        if(::getpeername(i.fd, (sockaddr*)&addr, &len) == 0) {
+            auto peer = std::dynamic_pointer_cast<IPAddress>(Address::Create((sockaddr*)&addr, len));
+            if(peer)
+                os << " peer=" << *peer;
+        }
+        os << " read_bytes=" << i.read_bytes
+           << " write_bytes=" << i.write_bytes
+           << " syscalls=" << i.syscalls
+           << " parks=" << i.parks
+           << " timeouts=" << i.timeouts
+           << " parked_us=" << i.parked_us << '\n';
+    }
+    return os;
+}
+
+void FdManager::reset_stats() {
+    RWMutexType::ReadLock lock(m_mutex);
+    for(auto& i : m_datas) {
+        if(i)
+            i->stats.reset();
+    }
+}
+
 } // namespace qff
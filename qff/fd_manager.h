@@ -1,24 +1,56 @@
 #ifndef __QFF_FD_MANAGER_H__
 #define __QFF_FD_MANAGER_H__
 
+#include <atomic>
+#include <iostream>
+
 #include "thread.h"
 #include "io_manager.h"
 #include "singleton.h"
 
 namespace qff {
 
+//counters of the hooked io on one fd, relaxed since they are only read for reports.
+struct FdStats final {
+    std::atomic<uint64_t> read_bytes = {0};
+    std::atomic<uint64_t> write_bytes = {0};
+    std::atomic<uint64_t> syscalls = {0};
+    //times the fiber parked on EAGAIN.
+    std::atomic<uint64_t> parks = {0};
+    std::atomic<uint64_t> timeouts = {0};
+    std::atomic<uint64_t> parked_us = {0};
+
+    void reset() noexcept;
+};
+
+//a plain copy of FdStats taken for a report.
+struct FdStatsSnapshot final {
+    int fd = -1;
+    uint64_t read_bytes = 0;
+    uint64_t write_bytes = 0;
+    uint64_t syscalls = 0;
+    uint64_t parks = 0;
+    uint64_t timeouts = 0;
+    uint64_t parked_us = 0;
+};
+
 struct FdContext final {
     typedef std::shared_ptr<FdContext> ptr;
 
     bool is_init: 1;
     bool is_socket: 1;
+    bool is_file: 1;
     bool sys_non_block: 1;
+    //hooked io runs on the FileIOPool, see set_file_io_offload().
+    bool file_offload: 1;
 
     int fd;
 
     uint64_t recv_timeout;
     uint64_t send_timeout;
 
+    FdStats stats;
+
     FdContext(int fd) noexcept;
 };
 
@@ -26,10 +58,22 @@ class FdManager final {
 public:
     typedef RWMutex RWMutexType;
 
+    enum StatsOrder {
+        BY_PARKED_TIME,
+        BY_BYTES
+    };
+
     FdManager();
 
     FdContext::ptr add_or_get_fdctx(int fd, bool auto_create = false);
     void del_fdctx(int fd) noexcept;
+
+    //the n open fds with the most parked time or bytes, largest first.
+    //counters of an fd go away with its close().
+    std::vector<FdStatsSnapshot> get_top_stats(size_t n, StatsOrder order = BY_PARKED_TIME);
+    //one line per fd, ip sockets also show their peer.
+    std::ostream& dump_top_stats(std::ostream& os, size_t n, StatsOrder order = BY_PARKED_TIME);
+    void reset_stats();
 private:
     RWMutexType m_mutex;
     std::vector<FdContext::ptr> m_datas;
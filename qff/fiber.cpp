@@ -14,6 +14,12 @@ namespace qff {
 static std::atomic<fid_t> s_fiber_id {0};
 static std::atomic<size_t> s_fiber_count {0};
 
+//zeroed, the empty sets.
+static SpinLock s_signal_lock;
+static ::sigset_t s_blocked_signals;
+static ::sigset_t s_released_signals;
+static std::atomic<uint32_t> s_signal_version {0};
+
 static thread_local Fiber* t_fiber = nullptr;
 static thread_local std::shared_ptr<Fiber> t_thread_fiber = nullptr;
 
@@ -41,12 +47,16 @@ void Fiber::Init() {
 
 void Fiber::YieldToReady() noexcept {
     assert(t_fiber != t_thread_fiber.get());
+    if(UNLIKELY(t_fiber->m_yield_hooks))
+        t_fiber->run_yield_hooks();
     t_fiber->m_state = READY;
     t_fiber->swap_out();
 }
 
 void Fiber::YieldToHold() noexcept {
     assert(t_fiber != t_thread_fiber.get());
+    if(UNLIKELY(t_fiber->m_yield_hooks))
+        t_fiber->run_yield_hooks();
     t_fiber->m_state = HOLD;
     t_fiber->swap_out();
 }
@@ -55,6 +65,65 @@ size_t Fiber::GetTotalFibers() noexcept {
     return s_fiber_count;
 }
 
+void Fiber::AddYieldHook(YieldHook* hook) noexcept {
+    if(hook->owner || !t_fiber)
+        return;
+    hook->owner = t_fiber;
+    hook->next = t_fiber->m_yield_hooks;
+    t_fiber->m_yield_hooks = hook;
+}
+
+void Fiber::DelYieldHook(YieldHook* hook) noexcept {
+    if(!hook->owner)
+        return;
+    YieldHook** it = &hook->owner->m_yield_hooks;
+    while(*it && *it != hook)
+        it = &(*it)->next;
+    if(*it)
+        *it = hook->next;
+    hook->next = nullptr;
+    hook->owner = nullptr;
+}
+
+void Fiber::SetSignalBlocked(int signo, bool blocked) noexcept {
+    ::sigset_t mask;
+    ::sigemptyset(&mask);
+    if(::sigaddset(&mask, signo))
+        return;
+    SpinLock::Lock lock(s_signal_lock);
+    ::sigaddset(blocked ? &s_blocked_signals : &s_released_signals, signo);
+    ::sigdelset(blocked ? &s_released_signals : &s_blocked_signals, signo);
+    ++s_signal_version;
+    lock.unlock();
+    ::pthread_sigmask(blocked ? SIG_BLOCK : SIG_UNBLOCK, &mask, nullptr);
+}
+
+void Fiber::update_signal_mask() noexcept {
+    if(LIKELY(m_signal_version == s_signal_version.load(std::memory_order_acquire)))
+        return;
+    SpinLock::Lock lock(s_signal_lock);
+    for(int i = 1; i < NSIG; ++i) {
+        if(::sigismember(&s_blocked_signals, i) == 1)
+            ::sigaddset(&m_uct.uc_sigmask, i);
+        else if(::sigismember(&s_released_signals, i) == 1)
+            ::sigdelset(&m_uct.uc_sigmask, i);
+    }
+    m_signal_version = s_signal_version;
+}
+
+void Fiber::run_yield_hooks() noexcept {
+    //detached first, so a hook may arm itself again for the next yield.
+    YieldHook* hook = m_yield_hooks;
+    m_yield_hooks = nullptr;
+    while(hook) {
+        YieldHook* next = hook->next;
+        hook->next = nullptr;
+        hook->owner = nullptr;
+        hook->fun(hook->arg);
+        hook = next;
+    }
+}
+
 Fiber::Fiber() noexcept 
     :m_id(++s_fiber_id)
     ,m_state(EXEC) {
@@ -118,6 +187,7 @@ void Fiber::reset(CallBackType cb) noexcept {
     assert(m_state == TERM || m_state == INIT);
 
     m_cb = cb;
+    m_thread_id = -1;
 
     int rt = ::getcontext(&m_uct);
     if(UNLIKELY(rt)) {
@@ -139,6 +209,7 @@ void Fiber::swap_in() noexcept {
 
     t_thread_fiber->m_state = HOLD;
     m_state = EXEC;
+    this->update_signal_mask();
     int rt = ::swapcontext(&t_thread_fiber->m_uct, &m_uct);
     if(UNLIKELY(rt)) {
         QFF_LOG_FATAL(QFF_LOG_SYSTEM) << "swapcontext() fatal. swapIn()";
@@ -149,6 +220,7 @@ void Fiber::swap_in() noexcept {
 void Fiber::swap_out() noexcept {
     t_fiber = t_thread_fiber.get();
     t_fiber->m_state = EXEC;
+    t_fiber->update_signal_mask();
     int rt = ::swapcontext(&m_uct, &t_thread_fiber->m_uct);
     if(UNLIKELY(rt)) {
         QFF_LOG_FATAL(QFF_LOG_SYSTEM) << "swapcontext() fatal. swapOut()";
@@ -162,6 +234,7 @@ void Fiber::call() noexcept {
 
     Scheduler::GetCacheFiber()->m_state = HOLD;
     m_state = EXEC;
+    this->update_signal_mask();
 
     int rt = ::swapcontext(&Scheduler::GetCacheFiber()->m_uct, &m_uct);
 
@@ -174,6 +247,7 @@ void Fiber::call() noexcept {
 void Fiber::back() noexcept {
     t_fiber = Scheduler::GetCacheFiber();
     t_fiber->m_state = EXEC;
+    t_fiber->update_signal_mask();
     int rt = ::swapcontext(&m_uct, &Scheduler::GetCacheFiber()->m_uct);
     if(UNLIKELY(rt)) {
         QFF_LOG_FATAL(QFF_LOG_SYSTEM) << "swapcontext() fatal. swapOut()";
@@ -186,6 +260,8 @@ void Fiber::MainFunc() noexcept {
      try {
          cur->m_cb();
          cur->m_cb = nullptr;
+         if(UNLIKELY(cur->m_yield_hooks))
+             cur->run_yield_hooks();
          cur->m_state = TERM;
      } catch(const std::exception& e) {
          cur ->m_state = EXCEPT;
@@ -205,6 +281,8 @@ void Fiber::CallerMainFunc() noexcept {
     try {
         cur->m_cb();
         cur->m_cb = nullptr;
+        if(UNLIKELY(cur->m_yield_hooks))
+            cur->run_yield_hooks();
         cur->m_state = TERM;
     } catch(const std::exception& e) {
         cur ->m_state = EXCEPT;
@@ -2,6 +2,8 @@
 #define __QFF_FIBER_H__
 
 #include <string>
+#include <sys/types.h>
+#include <signal.h>
 #include <ucontext.h>
 #include <memory>
 #include <functional>
@@ -32,6 +34,14 @@ public:
         EXCEPT
     };
 
+    //runs once, right before its fiber next yields or ends. fun must not yield.
+    struct YieldHook {
+        void (*fun)(void* arg) = nullptr;
+        void* arg = nullptr;
+        YieldHook* next = nullptr;
+        Fiber* owner = nullptr;
+    };
+
     static fid_t GetFiberId() noexcept;
     static Fiber::ptr GetThis() noexcept;
     static void Init();
@@ -40,6 +50,15 @@ public:
 
     static size_t GetTotalFibers() noexcept;
 
+    //hooks of the current fiber, a hook already armed is left as it is.
+    static void AddYieldHook(YieldHook* hook) noexcept;
+    static void DelYieldHook(YieldHook* hook) noexcept;
+
+    //swapcontext restores the signal mask a fiber last ran with, so the signals set
+    //here are patched into every context switched to. the calling thread changes at
+    //once, other threads on their next switch.
+    static void SetSignalBlocked(int signo, bool blocked) noexcept;
+
     Fiber(CallBackType cb, size_t stacksize = 1024*1024
                             , bool use_caller = false) noexcept;
     ~Fiber() noexcept;
@@ -59,6 +78,9 @@ private:
 
     static void MainFunc() noexcept;
     static void CallerMainFunc() noexcept;
+
+    void run_yield_hooks() noexcept;
+    void update_signal_mask() noexcept;
 private:
     fid_t m_id = 0;
     State m_state = INIT;
@@ -68,6 +90,11 @@ private:
 
     ucontext_t m_uct;
     CallBackType m_cb;
+    YieldHook* m_yield_hooks = nullptr;
+    //set once the fiber ran on a thread it was scheduled to, later schedules
+    //without a thread keep it there. -1 lets any worker run it.
+    ::pid_t m_thread_id = -1;
+    uint32_t m_signal_version = 0;
 };
 
 } // namespace qff
@@ -0,0 +1,54 @@
+#include "fiber_waiter.h"
+
+namespace qff {
+
+void FiberWaiter::park(List& list, MutexType& mutex) {
+    m_fiber = Fiber::GetThis();
+    m_list = &list;
+    m_it = list.insert(list.end(), this);
+    m_mutex = &mutex;
+}
+
+bool FiberWaiter::wait(IOManager* iom, uint64_t timeout_ms) {
+    TimerHandle timer;
+    if(timeout_ms != (uint64_t)-1)
+        timer = iom->add_timer_handle(timeout_ms, [this, iom]{ this->on_timeout(iom); });
+    Fiber::YieldToHold();
+    if(timer && timer.cancel()) {
+        //the timeout already fired and its callback still refers to this frame.
+        while(!m_timer_done.load(std::memory_order_acquire))
+            Fiber::YieldToReady();
+    }
+    return !m_timed_out;
+}
+
+Fiber::ptr FiberWaiter::wake() noexcept {
+    m_list->erase(m_it);
+    m_list = nullptr;
+    return m_fiber;
+}
+
+void FiberWaiter::WakeAll(List& list, std::vector<Fiber::ptr>& fibers) {
+    for(auto i : list) {
+        i->m_list = nullptr;
+        fibers.push_back(i->m_fiber);
+    }
+    list.clear();
+}
+
+void FiberWaiter::on_timeout(IOManager* iom) {
+    Fiber::ptr fiber;
+    {
+        MutexType::Lock lock(*m_mutex);
+        if(m_list) {
+            m_timed_out = true;
+            fiber = this->wake();
+        }
+    }
+    if(fiber)
+        iom->schedule(fiber);
+    //the frame may be gone right after this store.
+    m_timer_done.store(true, std::memory_order_release);
+}
+
+} // namespace qff
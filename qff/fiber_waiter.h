@@ -0,0 +1,49 @@
+#ifndef __QFF_FIBER_WAITER_H__
+#define __QFF_FIBER_WAITER_H__
+
+#include <list>
+#include <vector>
+#include <atomic>
+
+#include "fiber.h"
+#include "io_manager.h"
+#include "thread.h"
+
+namespace qff {
+
+//a fiber parked on a wait list until it is woken or its timeout runs out.
+//kept on the waiting fiber's stack, whoever takes it off the list schedules it, exactly once.
+class FiberWaiter {
+public:
+    NONECOPYABLE(FiberWaiter);
+    typedef SpinLock MutexType;
+    typedef std::list<FiberWaiter*> List;
+
+    FiberWaiter() noexcept {}
+
+    //links the calling fiber at the back of list, mutex must be held and guards the list.
+    void park(List& list, MutexType& mutex);
+    //yields until woken, call with the mutex released right after park().
+    //returns false when timeout_ms ran out first, -1 waits forever.
+    bool wait(IOManager* iom, uint64_t timeout_ms);
+    //unlinks the waiter and returns the fiber to schedule, locked.
+    Fiber::ptr wake() noexcept;
+    //unlinks every waiter of the list, locked.
+    static void WakeAll(List& list, std::vector<Fiber::ptr>& fibers);
+
+    bool is_parked() const noexcept { return m_list != nullptr;}
+    bool is_timed_out() const noexcept { return m_timed_out;}
+private:
+    void on_timeout(IOManager* iom);
+private:
+    Fiber::ptr m_fiber;
+    List* m_list = nullptr;
+    List::iterator m_it;
+    MutexType* m_mutex = nullptr;
+    bool m_timed_out = false;
+    std::atomic<bool> m_timer_done = {false};
+};
+
+} // namespace qff
+
+#endif
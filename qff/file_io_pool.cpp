@@ -0,0 +1,64 @@
+#include "file_io_pool.h"
+#include "io_manager.h"
+
+namespace qff {
+
+FileIOPool::FileIOPool(size_t thread_count, size_t queue_depth)
+    :m_thread_count(thread_count ? thread_count : 1)
+    ,m_queue_depth(queue_depth ? queue_depth : 1) {
+    m_threads.resize(m_thread_count);
+    for(size_t i = 0; i < m_thread_count; ++i) {
+        m_threads[i] = std::make_shared<Thread>(std::bind(&FileIOPool::run, this)
+                                        , "file_io_" + std::to_string(i));
+    }
+}
+
+FileIOPool::~FileIOPool() noexcept {
+    m_stopping = true;
+    for(size_t i = 0; i < m_thread_count; ++i)
+        m_sem.notify();
+    for(auto& i : m_threads)
+        i->join();
+}
+
+bool FileIOPool::submit(CallBackType cb) {
+    IOManager* iom = IOManager::GetThis();
+    if(!iom)
+        return false;
+
+    MutexType::Lock lock(m_mutex);
+    if(m_tasks.size() >= m_queue_depth)
+        return false;
+    iom->hold_pending();
+    m_tasks.push_back({cb, Fiber::GetThis(), iom});
+    lock.unlock();
+
+    m_sem.notify();
+    //the pool may schedule us back before we are on hold, the scheduler skips EXEC fibers until then.
+    Fiber::YieldToHold();
+    return true;
+}
+
+void FileIOPool::run() {
+    Task task;
+    while(true) {
+        m_sem.wait();
+        if(m_stopping)
+            break;
+
+        MutexType::Lock lock(m_mutex);
+        if(m_tasks.empty())
+            continue;
+        task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+        lock.unlock();
+
+        task.cb();
+        task.iom->schedule(task.fiber);
+        task.iom->release_pending();
+        task.fiber.reset();
+        task.cb = nullptr;
+    }
+}
+
+} // namespace qff
@@ -0,0 +1,51 @@
+#ifndef __QFF_FILE_IO_POOL_H__
+#define __QFF_FILE_IO_POOL_H__
+
+#include <memory>
+#include <deque>
+#include <vector>
+#include <atomic>
+
+#include "thread.h"
+#include "fiber.h"
+
+namespace qff {
+
+class IOManager;
+
+//runs blocking regular-file syscalls on its own threads while the calling fiber is parked.
+class FileIOPool final {
+public:
+    NONECOPYABLE(FileIOPool);
+    typedef std::function<void()> CallBackType;
+    typedef Mutex MutexType;
+
+    FileIOPool(size_t thread_count = 4, size_t queue_depth = 1024);
+    ~FileIOPool() noexcept;
+
+    //returns false when the queue is full, the caller should run the call itself.
+    bool submit(CallBackType cb);
+
+    size_t get_thread_count() const noexcept { return m_thread_count; }
+    size_t get_queue_depth() const noexcept { return m_queue_depth; }
+private:
+    struct Task {
+        CallBackType cb;
+        Fiber::ptr fiber;
+        IOManager* iom = nullptr;
+    };
+
+    void run();
+private:
+    size_t m_thread_count;
+    size_t m_queue_depth;
+    std::atomic<bool> m_stopping = {false};
+    MutexType m_mutex;
+    Semaphore m_sem;
+    std::deque<Task> m_tasks;
+    std::vector<Thread::ptr> m_threads;
+};
+
+} // namespace qff
+
+#endif
@@ -0,0 +1,75 @@
+#include "histogram.h"
+
+#include <algorithm>
+
+namespace qff {
+
+static size_t BucketIndex(uint64_t value) noexcept {
+    if(!value)
+        return 0;
+    return 64 - __builtin_clzll(value);
+}
+
+Histogram::Histogram() noexcept {
+    for(auto& i : m_buckets)
+        i.store(0, std::memory_order_relaxed);
+}
+
+void Histogram::record(uint64_t value) noexcept {
+    m_buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while(value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed));
+}
+
+void Histogram::reset() noexcept {
+    for(auto& i : m_buckets)
+        i.store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::get_bucket(size_t index) const noexcept {
+    if(index >= BUCKET_COUNT)
+        return 0;
+    return m_buckets[index].load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::get_avg() const noexcept {
+    uint64_t count = get_count();
+    return count ? get_sum() / count : 0;
+}
+
+uint64_t Histogram::get_percentile(double p) const noexcept {
+    uint64_t count = get_count();
+    if(!count)
+        return 0;
+    uint64_t rank = p * count;
+    uint64_t seen = 0;
+    for(size_t i = 0; i < BUCKET_COUNT; ++i) {
+        seen += get_bucket(i);
+        if(seen > rank) {
+            uint64_t bound = i ? (i == 64 ? ~0ull : (1ull << i) - 1) : 0;
+            return std::min(bound, get_max());
+        }
+    }
+    return get_max();
+}
+
+std::ostream& Histogram::dump(std::ostream& os) const {
+    os << "count=" << get_count()
+       << " avg=" << get_avg()
+       << " p50<=" << get_percentile(0.5)
+       << " p99<=" << get_percentile(0.99)
+       << " p999<=" << get_percentile(0.999)
+       << " max=" << get_max();
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const Histogram& histogram) {
+    return histogram.dump(os);
+}
+
+} // namespace qff
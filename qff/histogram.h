@@ -0,0 +1,39 @@
+#ifndef __QFF_HISTOGRAM_H__
+#define __QFF_HISTOGRAM_H__
+
+#include <atomic>
+#include <iostream>
+
+namespace qff {
+
+//power-of-two buckets, bucket i holds values in [2^(i-1), 2^i).
+class Histogram final {
+public:
+    static const size_t BUCKET_COUNT = 65;
+
+    Histogram() noexcept;
+
+    void record(uint64_t value) noexcept;
+    void reset() noexcept;
+
+    uint64_t get_count() const noexcept { return m_count.load(std::memory_order_relaxed); }
+    uint64_t get_sum() const noexcept { return m_sum.load(std::memory_order_relaxed); }
+    uint64_t get_max() const noexcept { return m_max.load(std::memory_order_relaxed); }
+    uint64_t get_bucket(size_t index) const noexcept;
+    uint64_t get_avg() const noexcept;
+    //upper bound of the bucket holding the p-th percentile, p in [0, 1].
+    uint64_t get_percentile(double p) const noexcept;
+
+    std::ostream& dump(std::ostream& os) const;
+private:
+    std::atomic<uint64_t> m_buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> m_count = {0};
+    std::atomic<uint64_t> m_sum = {0};
+    std::atomic<uint64_t> m_max = {0};
+};
+
+std::ostream& operator<<(std::ostream& os, const Histogram& histogram);
+
+} // namespace qff
+
+#endif
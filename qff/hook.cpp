@@ -4,17 +4,25 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <stdarg.h>
+#include <atomic>
+#include <type_traits>
 
 #include "log.h"
 #include "io_manager.h"
 #include "fd_manager.h"
+#include "file_io_pool.h"
+#include "clock.h"
 #include "macro.h"
 
 namespace qff {
 
 static thread_local bool t_hook_enable = false;
 static int s_connect_timeout = -1;
+static size_t s_file_io_threads = 4;
+static size_t s_file_io_queue_depth = 1024;
 
 #define HOOK_FUN(XX)    \
     XX(sleep)           \
@@ -23,16 +31,28 @@ static int s_connect_timeout = -1;
     XX(socket)          \
     XX(connect)         \
     XX(accept)          \
+    XX(accept4)         \
+    XX(poll)            \
+    XX(select)          \
+    XX(epoll_wait)      \
     XX(read)            \
     XX(readv)           \
     XX(recv)            \
     XX(recvfrom)        \
     XX(recvmsg)         \
+    XX(recvmmsg)        \
+    XX(pread)           \
     XX(write)           \
     XX(writev)          \
     XX(send)            \
     XX(sendto)          \
     XX(sendmsg)         \
+    XX(sendmmsg)        \
+    XX(pwrite)          \
+    XX(sendfile)        \
+    XX(splice)          \
+    XX(fsync)           \
+    XX(fdatasync)       \
     XX(close)           \
     XX(fcntl)           \
     XX(ioctl)           \
@@ -51,6 +71,29 @@ void set_connect_timeout(int ms) {
     s_connect_timeout = ms;
 }
 
+void set_file_io_threads(size_t count) {
+    s_file_io_threads = count;
+}
+
+void set_file_io_queue_depth(size_t depth) {
+    s_file_io_queue_depth = depth;
+}
+
+int set_file_io_offload(int fd, bool flag) {
+    FdContext::ptr ctx = FdMgr::Get()->add_or_get_fdctx(fd, true);
+    if(!ctx || !ctx->is_init || !ctx->is_file) {
+        errno = EBADF;
+        return -1;
+    }
+    ctx->file_offload = flag;
+    return 0;
+}
+
+static FileIOPool* GetFileIOPool() {
+    static FileIOPool s_pool(s_file_io_threads, s_file_io_queue_depth);
+    return &s_pool;
+}
+
 struct HookIniter {
     HookIniter() {
         #define XX(name) name##_f = (name##_fun)dlsym(RTLD_NEXT, #name);
@@ -67,10 +110,166 @@ void SetSleepySign(qff::IOManager* iom, bool flag) {
 
 } //namespace qff
 
-struct timer_cond {
+//a hooked call parked on an event, kept on the waiting fiber's stack.
+struct io_wait {
+    qff::IOManager* iom;
+    int fd;
+    qff::IOManager::EventType event;
     int cancelled = 0;
+    std::atomic<bool> timer_done = {false};
 };
 
+static void OnIoTimeout(io_wait* wait) {
+    if(!wait->cancelled) {
+        wait->cancelled = ETIMEDOUT;
+        wait->iom->cancel_event(wait->fd, wait->event);
+    }
+    //the frame may be gone right after this store.
+    wait->timer_done.store(true, std::memory_order_release);
+}
+
+static qff::TimerHandle StartIoTimer(io_wait* wait, uint64_t timeout_ms) {
+    if(timeout_ms == (uint64_t)-1)
+        return qff::TimerHandle();
+    //one pointer fits in std::function's local storage, nothing is allocated.
+    return wait->iom->add_timer_handle(timeout_ms, [wait]{ OnIoTimeout(wait); });
+}
+
+static void StopIoTimer(io_wait* wait, qff::TimerHandle& timer) {
+    if(!timer || timer.cancel() == 0)
+        return;
+    //the timeout already fired and its callback still refers to this frame.
+    while(!wait->timer_done.load(std::memory_order_acquire))
+        qff::Fiber::YieldToReady();
+}
+
+//a poll parked on several fds, kept on the waiting fiber's stack.
+struct poll_wait {
+    qff::IOManager* iom;
+    qff::Fiber::ptr fiber;
+    std::atomic<bool> woken = {false};
+    //callbacks that have run to the end.
+    std::atomic<int> finished = {0};
+};
+
+static void OnPollWake(poll_wait* wait) {
+    if(!wait->woken.exchange(true))
+        wait->iom->schedule(wait->fiber);
+    //the frame may be gone right after this add.
+    wait->finished.fetch_add(1, std::memory_order_release);
+}
+
+//revents marks what was registered until poll_f overwrites it.
+static const short POLL_WAIT_READ = 1;
+static const short POLL_WAIT_WRITE = 2;
+
+static void ClearPollWait(qff::IOManager* iom, struct pollfd* fds, nfds_t nfds, int& fired) {
+    for(nfds_t i = 0; i < nfds; ++i) {
+        if((fds[i].revents & POLL_WAIT_READ) && iom->del_event(fds[i].fd, qff::IOManager::READ))
+            ++fired;
+        if((fds[i].revents & POLL_WAIT_WRITE) && iom->del_event(fds[i].fd, qff::IOManager::WRITE))
+            ++fired;
+        fds[i].revents = 0;
+    }
+}
+
+//parks the fiber until one of the fds is ready, every fd is registered with the IOManager.
+static int DoPoll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
+    int rt = poll_f(fds, nfds, 0);
+    if(rt != 0 || timeout_ms == 0)
+        return rt;
+    qff::IOManager* iom = qff::IOManager::GetThis();
+    if(!iom)
+        return poll_f(fds, nfds, timeout_ms);
+
+    uint64_t deadline = timeout_ms < 0 ? ~0ull : qff::GetMonotonicMS() + timeout_ms;
+    while(true) {
+        poll_wait wait;
+        wait.iom = iom;
+        wait.fiber = qff::Fiber::GetThis();
+        poll_wait* wait_ptr = &wait;
+        auto cb = [wait_ptr]{ OnPollWake(wait_ptr); };
+
+        bool registered = true;
+        for(nfds_t i = 0; i < nfds && registered; ++i) {
+            fds[i].revents = 0;
+            if(fds[i].fd < 0)
+                continue;
+            //an fd listed twice is registered once, by its first entry wanting the event.
+            short merged = 0;
+            for(nfds_t j = 0; j < i; ++j) {
+                if(fds[j].fd == fds[i].fd)
+                    merged |= fds[j].revents;
+            }
+            if((fds[i].events & (POLLIN | POLLPRI | POLLRDHUP)) && !(merged & POLL_WAIT_READ)) {
+                registered = !iom->add_event(fds[i].fd, qff::IOManager::READ, cb);
+                if(registered)
+                    fds[i].revents |= POLL_WAIT_READ;
+            }
+            if(registered && (fds[i].events & POLLOUT) && !(merged & POLL_WAIT_WRITE)) {
+                registered = !iom->add_event(fds[i].fd, qff::IOManager::WRITE, cb);
+                if(registered)
+                    fds[i].revents |= POLL_WAIT_WRITE;
+            }
+        }
+
+        qff::TimerHandle timer;
+        if(registered) {
+            if(deadline != ~0ull)
+                timer = iom->add_timer_handle(deadline - std::min(deadline, qff::GetMonotonicMS()), cb);
+            qff::Fiber::YieldToHold();
+        }
+
+        int fired = 0;
+        ClearPollWait(iom, fds, nfds, fired);
+        if(timer && timer.cancel())
+            ++fired;
+        while(wait.finished.load(std::memory_order_acquire) < fired)
+            qff::Fiber::YieldToReady();
+
+        uint64_t now = qff::GetMonotonicMS();
+        int left_ms = deadline == ~0ull ? -1 : deadline > now ? deadline - now : 0;
+        //an fd epoll refuses, e.g. a regular file, leaves the plain blocking call.
+        if(!registered)
+            return poll_f(fds, nfds, left_ms);
+        rt = poll_f(fds, nfds, 0);
+        if(rt != 0 || left_ms == 0)
+            return rt;
+    }
+}
+
+//a new fd may reuse the number of one closed behind the hooks, fclose closes
+//inside libc, so whatever context is left under it is dropped first.
+static void NewFdContext(int fd) {
+    qff::FdMgr::Get()->del_fdctx(fd);
+    qff::FdMgr::Get()->add_or_get_fdctx(fd, true);
+}
+
+static void AddIoBytes(qff::FdStats& stats, qff::IOManager::EventType event, uint64_t bytes) {
+    if(event == qff::IOManager::READ)
+        stats.read_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    else
+        stats.write_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+template<class OriginFun, typename ... Args>
+static ssize_t do_file_io(int fd, OriginFun fun, Args&&... args) {
+    if(!qff::IOManager::GetThis())
+        return fun(fd, std::forward<Args>(args)...);
+
+    ssize_t result = -1;
+    int error = 0;
+    bool queued = qff::GetFileIOPool()->submit([&]() {
+        result = fun(fd, args...);
+        error = errno;
+    });
+    if(!queued)
+        return fun(fd, std::forward<Args>(args)...);
+
+    errno = error;
+    return result;
+}
+
 template<class OriginFun, typename ... Args>
 static ssize_t do_io(int fd, OriginFun fun, std::string_view hook_fun_name,
         qff::IOManager::EventType event, int timeout_so, Args&&... args) {
@@ -79,7 +278,7 @@ static ssize_t do_io(int fd, OriginFun fun, std::string_view hook_fun_name,
     
     //QFF_LOG_DEBUG(QFF_LOG_SYSTEM) << hook_fun_name << " is hooked";
 
-    qff::FdContext::ptr ctx = qff::FdMgr::Get()->add_or_get_fdctx(fd);
+    qff::FdContext::ptr ctx = qff::FdMgr::Get()->add_or_get_fdctx(fd, true);
 
     if(!ctx)
         return fun(fd, std::forward<Args>(args)...);
@@ -89,53 +288,67 @@ static ssize_t do_io(int fd, OriginFun fun, std::string_view hook_fun_name,
         return -1;
     }
 
+    if(ctx->is_file && ctx->file_offload) {
+        ssize_t result = do_file_io(fd, fun, std::forward<Args>(args)...);
+        ctx->stats.syscalls.fetch_add(1, std::memory_order_relaxed);
+        if(result > 0)
+            AddIoBytes(ctx->stats, event, result);
+        return result;
+    }
+
     if(!ctx->is_socket || !ctx->sys_non_block)
         return fun(fd, std::forward<Args>(args)...);
 
 
-    int timeout = timeout_so == SO_RCVTIMEO ? 
+    uint64_t timeout = timeout_so == SO_RCVTIMEO ? 
                     ctx->recv_timeout : ctx->send_timeout;
+    //the context stays referenced so close() cannot free the counters under us.
+    qff::FdStats& stats = ctx->stats;
 
-    std::shared_ptr<timer_cond> t_cond = std::make_shared<timer_cond>();
     ssize_t result = -1;
 
  while(true) {
         result = fun(fd, std::forward<Args>(args)...);
+        stats.syscalls.fetch_add(1, std::memory_order_relaxed);
         while(result == -1 && errno == EINTR) {
             result = fun(fd, std::forward<Args>(args)...);
+            stats.syscalls.fetch_add(1, std::memory_order_relaxed);
         }
         if(result == -1 && errno == EAGAIN) {
-            qff::IOManager* iom = qff::IOManager::GetThis();
-            qff::Timer::ptr timer;
+            io_wait wait;
+            wait.iom = qff::IOManager::GetThis();
+            wait.fd = fd;
+            wait.event = event;
             //QFF_LOG_DEBUG(QFF_LOG_SYSTEM) << hook_fun_name << " is hooked and addEvent()";
-            if(timeout != -1)
-                timer = iom->add_cond_timer(timeout, [&t_cond, fd, iom, event]{
-                    t_cond->cancelled = ETIMEDOUT;
-                    iom->cancel_event(fd, event);
-                }, t_cond);
+            qff::TimerHandle timer = StartIoTimer(&wait, timeout);
 
-            int rt = iom->add_event(fd, event);
+            int rt = wait.iom->add_event(fd, event);
             if(UNLIKELY(rt)) {
                 QFF_LOG_ERROR(QFF_LOG_SYSTEM) << hook_fun_name << " addEvent("
                     << fd << ", " << event << ")";
-                timer->cancel();
+                StopIoTimer(&wait, timer);
                 return -1;
             }
 
+            uint64_t park_start = qff::GetMonotonicUS();
             qff::Fiber::YieldToHold(); // One probability is timeout,and another is event being triggered.
+            stats.parks.fetch_add(1, std::memory_order_relaxed);
+            stats.parked_us.fetch_add(qff::GetMonotonicUS() - park_start, std::memory_order_relaxed);
 
-            if(t_cond->cancelled) {     //this is timeout operation.
-                errno = t_cond->cancelled;
+            StopIoTimer(&wait, timer);
+            if(wait.cancelled) {     //this is timeout operation.
+                stats.timeouts.fetch_add(1, std::memory_order_relaxed);
+                errno = wait.cancelled;
                 return -1;
             }
-
-            if(timer)
-                timer->cancel();
                 //successly. turn back "do" to run the function again.
             continue;
         }
         break;
     }
+    //calls returning ssize_t report bytes, the rest (accept, recvmmsg, fsync) count themselves.
+    if(std::is_same<decltype(fun(fd, args...)), ssize_t>::value && result > 0)
+        AddIoBytes(stats, event, result);
     return result;
 }
 
@@ -155,7 +368,7 @@ unsigned int sleep(unsigned int seconds) {
     qff::IOManager* iom = qff::IOManager::GetThis();
 
     qff::SetSleepySign(iom, true);
-    iom->add_timer(seconds*1000, [iom, fiber]{
+    iom->add_timer_handle(seconds*1000, [iom, fiber]{
         iom->schedule(fiber);
         qff::SetSleepySign(iom, false);
     });
@@ -171,7 +384,7 @@ int usleep(useconds_t usec) {
     qff::IOManager* iom = qff::IOManager::GetThis();
 
     qff::SetSleepySign(iom, true);
-    iom->add_timer(usec/1000, [iom, fiber]{
+    iom->add_timer_handle_us(usec, [iom, fiber]{
         iom->schedule(fiber);
         qff::SetSleepySign(iom, false);
     });
@@ -183,12 +396,12 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
     if(!qff::t_hook_enable)
         return nanosleep_f(req, rem);
 
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 /1000;
+    uint64_t timeout_us = req->tv_sec * 1000 * 1000ul + (req->tv_nsec + 999) / 1000;
     qff::Fiber::ptr fiber = qff::Fiber::GetThis();
     qff::IOManager* iom = qff::IOManager::GetThis();
 
     qff::SetSleepySign(iom, true);
-    iom->add_timer(timeout_ms, [iom, fiber]{
+    iom->add_timer_handle_us(timeout_us, [iom, fiber]{
         iom->schedule(fiber);
         qff::SetSleepySign(iom, false);
     });
@@ -204,7 +417,7 @@ int socket(int domain, int type, int protocol) {
     if(fd == -1)
         return -1;
 
-    qff::FdMgr::Get()->add_or_get_fdctx(fd, true);
+    NewFdContext(fd);
     return fd;
 }
 
@@ -228,35 +441,26 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if(errno != EINPROGRESS)
         return rt;
 
-    qff::IOManager* iom = qff::IOManager::GetThis();
-    qff::Timer::ptr timer;
-    std::shared_ptr<timer_cond> t_cond = std::make_shared<timer_cond>();
-    
-    if(timeout_ms != -1) {
-        timer = iom->add_cond_timer(timeout_ms, [&t_cond, fd, iom]() {
-            if(t_cond->cancelled)
-                return;
-            t_cond->cancelled = ETIMEDOUT;
-            iom->cancel_event(fd, qff::IOManager::WRITE);
-        }, t_cond);
-    }
+    io_wait wait;
+    wait.iom = qff::IOManager::GetThis();
+    wait.fd = fd;
+    wait.event = qff::IOManager::WRITE;
+    qff::TimerHandle timer = StartIoTimer(&wait, timeout_ms);
 
-    rt = iom->add_event(fd, qff::IOManager::WRITE);
+    rt = wait.iom->add_event(fd, qff::IOManager::WRITE);
     if(UNLIKELY(rt)) {
-        if(timer)
-            timer->cancel();
+        StopIoTimer(&wait, timer);
         QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "connect addEvent(" << fd << ", WRITE) error";
+        return -1;
     }
 
     qff::Fiber::YieldToHold();
-    if(t_cond->cancelled) {
-        errno = t_cond->cancelled;
+    StopIoTimer(&wait, timer);
+    if(wait.cancelled) {
+        errno = wait.cancelled;
         return -1;
     }
 
-    if(timer)
-        timer->cancel();
-
     int error = 0;
     socklen_t len = sizeof(int);
     if(::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len))
@@ -278,10 +482,101 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
     if(fd < 0)
         return -1;
 
-    qff::FdMgr::Get()->add_or_get_fdctx(fd, true);
+    NewFdContext(fd);
     return fd;
 }
 
+int accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    int fd = do_io(s, accept4_f, "accept4", qff::IOManager::READ, SO_RCVTIMEO, addr, addrlen, flags);
+    if(fd < 0)
+        return -1;
+
+    NewFdContext(fd);
+    return fd;
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    if(!qff::t_hook_enable)
+        return poll_f(fds, nfds, timeout);
+    return DoPoll(fds, nfds, timeout);
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+    if(!qff::t_hook_enable || (timeout && !timeout->tv_sec && !timeout->tv_usec))
+        return select_f(nfds, readfds, writefds, exceptfds, timeout);
+
+    std::vector<struct pollfd> fds;
+    for(int fd = 0; fd < nfds; ++fd) {
+        short events = 0;
+        if(readfds && FD_ISSET(fd, readfds))
+            events |= POLLIN;
+        if(writefds && FD_ISSET(fd, writefds))
+            events |= POLLOUT;
+        if(exceptfds && FD_ISSET(fd, exceptfds))
+            events |= POLLPRI;
+        if(events)
+            fds.push_back({fd, events, 0});
+    }
+
+    int timeout_ms = timeout ? timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000 : -1;
+    int rt = DoPoll(fds.data(), fds.size(), timeout_ms);
+    if(rt < 0)
+        return rt;
+
+    int count = 0;
+    for(auto& i : fds) {
+        if(i.revents & POLLNVAL) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+    if(readfds)
+        FD_ZERO(readfds);
+    if(writefds)
+        FD_ZERO(writefds);
+    if(exceptfds)
+        FD_ZERO(exceptfds);
+    for(auto& i : fds) {
+        if((i.events & POLLIN) && (i.revents & (POLLIN | POLLHUP | POLLERR))) {
+            FD_SET(i.fd, readfds);
+            ++count;
+        }
+        if((i.events & POLLOUT) && (i.revents & (POLLOUT | POLLERR))) {
+            FD_SET(i.fd, writefds);
+            ++count;
+        }
+        if((i.events & POLLPRI) && (i.revents & POLLPRI)) {
+            FD_SET(i.fd, exceptfds);
+            ++count;
+        }
+    }
+    return count;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    if(!qff::t_hook_enable || timeout == 0)
+        return epoll_wait_f(epfd, events, maxevents, timeout);
+
+    //an epoll fd polls readable while it has events pending.
+    struct pollfd fd = {epfd, POLLIN, 0};
+    uint64_t deadline = timeout < 0 ? ~0ull : qff::GetMonotonicMS() + timeout;
+    while(true) {
+        int rt = DoPoll(&fd, 1, timeout);
+        if(rt <= 0)
+            return rt;
+        rt = epoll_wait_f(epfd, events, maxevents, 0);
+        if(rt != 0)
+            return rt;
+        //another waiter took the events, wait out the rest of the timeout.
+        if(deadline != ~0ull) {
+            uint64_t now = qff::GetMonotonicMS();
+            if(now >= deadline)
+                return 0;
+            timeout = deadline - now;
+        }
+    }
+}
+
 ssize_t read(int fd, void *buf, size_t count) {
     return do_io(fd, read_f, "read", qff::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
@@ -302,6 +597,24 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
     return do_io(sockfd, recvmsg_f, "recvmsg", qff::IOManager::READ, SO_RCVTIMEO, msg, flags);
 }
 
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout) {
+    int rt = do_io(sockfd, recvmmsg_f, "recvmmsg", qff::IOManager::READ, SO_RCVTIMEO, msgvec, vlen, flags, timeout);
+    if(rt > 0 && qff::t_hook_enable) {
+        qff::FdContext::ptr ctx = qff::FdMgr::Get()->add_or_get_fdctx(sockfd);
+        if(ctx) {
+            uint64_t bytes = 0;
+            for(int i = 0; i < rt; ++i)
+                bytes += msgvec[i].msg_len;
+            AddIoBytes(ctx->stats, qff::IOManager::READ, bytes);
+        }
+    }
+    return rt;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    return do_io(fd, pread_f, "pread", qff::IOManager::READ, SO_RCVTIMEO, buf, count, offset);
+}
+
 ssize_t write(int fd, const void *buf, size_t count) {
     return do_io(fd, write_f, "write", qff::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
@@ -322,6 +635,63 @@ ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
     return do_io(s, sendmsg_f, "sendmsg", qff::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
 }
 
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    int rt = do_io(sockfd, sendmmsg_f, "sendmmsg", qff::IOManager::WRITE, SO_SNDTIMEO, msgvec, vlen, flags);
+    if(rt > 0 && qff::t_hook_enable) {
+        qff::FdContext::ptr ctx = qff::FdMgr::Get()->add_or_get_fdctx(sockfd);
+        if(ctx) {
+            uint64_t bytes = 0;
+            for(int i = 0; i < rt; ++i)
+                bytes += msgvec[i].msg_len;
+            AddIoBytes(ctx->stats, qff::IOManager::WRITE, bytes);
+        }
+    }
+    return rt;
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    return do_io(fd, pwrite_f, "pwrite", qff::IOManager::WRITE, SO_SNDTIMEO, buf, count, offset);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    return do_io(out_fd, sendfile_f, "sendfile", qff::IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+}
+
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags) {
+    if(!qff::t_hook_enable || (flags & SPLICE_F_NONBLOCK))
+        return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+
+    //either end may be the one that blocks, wait only on those not ready.
+    while(true) {
+        ssize_t rt = splice_f(fd_in, off_in, fd_out, off_out, len, flags | SPLICE_F_NONBLOCK);
+        if(rt >= 0 || errno != EAGAIN)
+            return rt;
+
+        struct pollfd fds[2] = {{fd_in, POLLIN, 0}, {fd_out, POLLOUT, 0}};
+        if(poll_f(fds, 2, 0) < 0)
+            return -1;
+        nfds_t count = 0;
+        for(auto& i : fds) {
+            if(!(i.revents & (i.events | POLLERR | POLLHUP)))
+                fds[count++] = {i.fd, i.events, 0};
+        }
+        if(!count) {
+            qff::Fiber::YieldToReady();
+            continue;
+        }
+        if(DoPoll(fds, count, -1) < 0)
+            return -1;
+    }
+}
+
+int fsync(int fd) {
+    return do_io(fd, fsync_f, "fsync", qff::IOManager::WRITE, SO_SNDTIMEO);
+}
+
+int fdatasync(int fd) {
+    return do_io(fd, fdatasync_f, "fdatasync", qff::IOManager::WRITE, SO_SNDTIMEO);
+}
+
 int close(int fd) {
     if(!qff::t_hook_enable)
         return close_f(fd);
@@ -2,13 +2,21 @@
 #include "macro.h"
 #include "log.h"
 #include "fd_manager.h"
+#include "clock.h"
+#include "hook.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <assert.h>
+#include <algorithm>
 
 namespace qff {
     
@@ -83,35 +91,127 @@ IOManager::EventContext& IOManager::FdContext::get_context(EventType event) noex
     std::terminate();
 }
 
-void IOManager::FdContext::trigger_event(EventType event) {
+void IOManager::FdContext::trigger_event(EventType event, uint64_t ready_time) {
     assert(event & events);
 
     events = (EventType)(events & ~event);
     EventContext& event_context = get_context(event);
     if(auto p1 = std::get_if<CallBackType>(&event_context.fiber_or_func)) {
-        event_context.scheduler->schedule(*p1);
+        event_context.scheduler->schedule(*p1, -1, ready_time);
     } else {
         auto p2 = std::get_if<Fiber::ptr>(&event_context.fiber_or_func);
-        event_context.scheduler->schedule(*p2);
+        event_context.scheduler->schedule(*p2, -1, ready_time);
     }
     
     event_context.clear();
 }
 
+#ifndef __NR_epoll_pwait2
+#define __NR_epoll_pwait2 441
+#endif
+
+IOManager::WorkerContext::~WorkerContext() noexcept {
+    if(wait_fd >= 0)
+        ::close(wait_fd);
+    if(timer_fd >= 0)
+        ::close(timer_fd);
+}
+
+void IOManager::WorkerContext::record_wake_latency(uint64_t us) noexcept {
+    ++wake_count;
+    wake_latency_total_us += us;
+    uint64_t max = wake_latency_max_us;
+    while(us > max && !wake_latency_max_us.compare_exchange_weak(max, us));
+}
+
+static uint64_t GetThreadCpuUS() noexcept {
+    timespec ts;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
 static thread_local IOManager* t_iomanager = nullptr;
 
+//kept blocked on every context and let through only while a worker waits in epoll,
+//so a wake sent before the wait is still pending when it starts.
+static const int WAKE_SIGNAL = SIGURG;
+
+static Mutex s_wake_mutex;
+static size_t s_wake_users = 0;
+static bool s_wake_was_blocked = false;
+static struct ::sigaction s_wake_old_action;
+
+static void OnWakeSignal(int signo, ::siginfo_t* info, void* context) {
+    //a tickle_thread() only has to end the wait, any other SIGURG, e.g. out of
+    //band tcp data, goes to the action installed before the first IOManager.
+    if(info->si_code == SI_TKILL && info->si_pid == ::getpid())
+        return;
+    if(s_wake_old_action.sa_flags & SA_SIGINFO)
+        s_wake_old_action.sa_sigaction(signo, info, context);
+    else if(s_wake_old_action.sa_handler != SIG_DFL && s_wake_old_action.sa_handler != SIG_IGN)
+        s_wake_old_action.sa_handler(signo);
+}
+
+static void AcquireWakeSignal() noexcept {
+    Mutex::Lock lock(s_wake_mutex);
+    if(s_wake_users++ == 0) {
+        ::sigset_t mask;
+        ::pthread_sigmask(SIG_BLOCK, nullptr, &mask);
+        s_wake_was_blocked = ::sigismember(&mask, WAKE_SIGNAL) == 1;
+        struct ::sigaction action;
+        ::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = OnWakeSignal;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        ::sigemptyset(&action.sa_mask);
+        ::sigaction(WAKE_SIGNAL, &action, &s_wake_old_action);
+    }
+    //also for a later IOManager, its workers inherit the mask of this thread.
+    Fiber::SetSignalBlocked(WAKE_SIGNAL, true);
+}
+
+//the last IOManager gone puts back the action and mask found by the first.
+static void ReleaseWakeSignal() noexcept {
+    Mutex::Lock lock(s_wake_mutex);
+    if(--s_wake_users != 0)
+        return;
+    ::sigaction(WAKE_SIGNAL, &s_wake_old_action, nullptr);
+    if(!s_wake_was_blocked)
+        Fiber::SetSignalBlocked(WAKE_SIGNAL, false);
+}
+
+//write end of the signal pipe of the IOManager handling each signal, plus one so
+//that zero means none.
+static std::atomic<int> s_signal_pipes[_NSIG];
+
+static void OnSignal(int signo) {
+    int fd = s_signal_pipes[signo].load(std::memory_order_acquire) - 1;
+    if(fd < 0)
+        return;
+    int saved_errno = errno;
+    uint8_t byte = signo;
+    ::write_f(fd, &byte, 1);
+    errno = saved_errno;
+}
+
 IOManager* IOManager::GetThis() {
     return t_iomanager;
 }
 
 IOManager::IOManager(size_t thread_count, const std::string& name, bool use_caller) 
     :Scheduler(thread_count, name, use_caller) {
+    ::sigemptyset(&m_signal_mask);
+    //before start(), spawned workers inherit the blocked mask.
+    AcquireWakeSignal();
     FdMgr::New();
     m_epfd = ::epoll_create(6666);
     if(m_epfd <= 0) {
         QFF_LOG_FATAL(QFF_LOG_SYSTEM) << "epoll_create() fatal";
         std::terminate();
     }
+    //epoll_pwait2 arrived in linux 5.11, seccomp filters may refuse it with EPERM.
+    ::epoll_event probe_event;
+    ::timespec probe_ts = {0, 0};
+    m_epoll_pwait2 = ::syscall(__NR_epoll_pwait2, m_epfd, &probe_event, 1, &probe_ts, nullptr, 0) >= 0;
 
     int rt = ::pipe(m_tickle_fds);
     if(rt) {
@@ -139,29 +239,49 @@ IOManager::IOManager(size_t thread_count, const std::string& name, bool use_call
     }
 
     this->contexts_resize(32);
+
+    m_workers.resize(this->get_worker_count());
+    for(auto& i : m_workers)
+        i = new WorkerContext;
+    this->init_timer_shards(m_workers.size());
+
     this->start();
 }
 
 IOManager::~IOManager() noexcept {
     this->stop();
+    for(auto& i : m_signal_cbs) {
+        this->restore_signal(i.first);
+        Fiber::SetSignalBlocked(i.first, false);
+    }
+    ReleaseWakeSignal();
     ::close(m_epfd);
     ::close(m_tickle_fds[0]);
     ::close(m_tickle_fds[1]);
+    if(m_signal_fd != -1)
+        ::close(m_signal_fd);
+    if(m_signal_pipe[0] != -1) {
+        ::close(m_signal_pipe[0]);
+        ::close(m_signal_pipe[1]);
+    }
     FdMgr::Delete();
     for(size_t i = 0; i < m_fd_contexts.size(); ++i) {
         if(!m_fd_contexts[i])
             continue;
         delete m_fd_contexts[i];
     }
+    for(auto i : m_workers)
+        delete i;
     if(t_iomanager == this) 
         t_iomanager = nullptr;
 }
 
 void IOManager::contexts_resize(size_t size) noexcept {
+    RWMutexType::WriteLock lock(m_mutex);
     size_t i = m_fd_contexts.size();
+    if(size <= i)
+        return;
     m_fd_contexts.resize(size);
-    m_mutex.unlock();
-    RWMutexType::WriteLock lock(m_mutex);
     try {
         for(;i < m_fd_contexts.size(); ++i) {
             m_fd_contexts[i] = new FdContext;
@@ -177,16 +297,22 @@ int IOManager::add_event(int fd, EventType event, CallBackType cb) noexcept {
     FdContext* fd_ctx = nullptr;
 
     RWMutexType::ReadLock lock(m_mutex);
-    if(m_fd_contexts.size() <= (size_t)fd)
+    if(m_fd_contexts.size() <= (size_t)fd) {
+        lock.unlock();
         this->contexts_resize(fd * 1.5);
+        lock.lock();
+    }
     fd_ctx = m_fd_contexts[fd];
     lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    //another waiter owns the event, overwriting it would leave that one parked forever.
     if(UNLIKELY(fd_ctx->events & event)) {
         QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "addEvent assert fd=" << fd
             << " event=" << (EPOLL_EVENTS)event
             << " fd_ctx.event=" << (EPOLL_EVENTS)fd_ctx->events;
+        errno = EEXIST;
+        return -1;
     }
 
     int ep_op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
@@ -206,6 +332,17 @@ int IOManager::add_event(int fd, EventType event, CallBackType cb) noexcept {
 
     ++m_pending_event_count;
 
+    if(ep_op == EPOLL_CTL_ADD && !fd_ctx->busy_poll_set) {
+        int usec = m_busy_poll_usec;
+        if(usec > 0) {
+            fd_ctx->busy_poll_set = true;
+            if(::setsockopt_f(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) && errno != ENOTSOCK) {
+                QFF_LOG_DEBUG(QFF_LOG_SYSTEM) << "setsockopt(" << fd << ", SO_BUSY_POLL, " << usec
+                    << ") errno=" << errno << " errstr=" << strerror(errno);
+            }
+        }
+    }
+
     fd_ctx->events = (EventType)(fd_ctx->events | event);
     EventContext& event_ctx = fd_ctx->get_context(event);
     if(UNLIKELY(event_ctx.scheduler)) {
@@ -231,7 +368,7 @@ int IOManager::del_event(int fd, EventType event) noexcept {
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if(UNLIKELY(!(fd_ctx->events & event)))
-        return false;
+        return -1;
     
     EventType new_epoll_types = (EventType)(fd_ctx->events & ~event);
     int ep_op = new_epoll_types ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
@@ -296,6 +433,7 @@ int IOManager::cancel_all(int fd) noexcept {
     lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    fd_ctx->busy_poll_set = false;
     if(UNLIKELY(!(fd_ctx->events)))
         return false;
     
@@ -327,6 +465,230 @@ int IOManager::cancel_all(int fd) noexcept {
     return 0;
 }
 
+int IOManager::add_signal(int signo, CallBackType cb) noexcept {
+    if(!cb)
+        return -1;
+    Mutex::Lock lock(m_signal_mutex);
+    ::sigset_t mask = m_signal_mask;
+    if(signo == WAKE_SIGNAL || ::sigaddset(&mask, signo)) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "add_signal(" << signo << ") invalid signal";
+        return -1;
+    }
+
+    //blocked first, a signal arriving meanwhile stays pending for the signalfd.
+    bool was_blocked = m_signal_cbs.count(signo);
+    Fiber::SetSignalBlocked(signo, true);
+    int fd = ::signalfd(m_signal_fd, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(fd == -1) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "signalfd(" << m_signal_fd << ") errno="
+            << errno << " errstr=" << strerror(errno);
+        if(!was_blocked)
+            Fiber::SetSignalBlocked(signo, false);
+        return -1;
+    }
+
+    if(m_signal_fd == -1) {
+        ::epoll_event ep_event;
+        ::memset(&ep_event, 0, sizeof(::epoll_event));
+        ep_event.events = EPOLLIN | EPOLLET;
+        ep_event.data.fd = fd;
+        if(::epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ep_event)) {
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "epoll_ctl(" << m_epfd << ", EPOLL_CTL_ADD, "
+                << fd << ") errno=" << errno << " errstr=" << strerror(errno);
+            ::close(fd);
+            Fiber::SetSignalBlocked(signo, false);
+            return -1;
+        }
+        m_signal_fd = fd;
+    }
+
+    if(!was_blocked && !this->forward_signal(signo)) {
+        Fiber::SetSignalBlocked(signo, false);
+        ::signalfd(m_signal_fd, &m_signal_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        return -1;
+    }
+
+    m_signal_mask = mask;
+    m_signal_cbs[signo] = cb;
+    lock.unlock();
+
+    this->sync_signal_mask();
+    return 0;
+}
+
+int IOManager::del_signal(int signo) noexcept {
+    Mutex::Lock lock(m_signal_mutex);
+    auto it = m_signal_cbs.find(signo);
+    if(it == m_signal_cbs.end())
+        return -1;
+    m_signal_cbs.erase(it);
+
+    ::sigdelset(&m_signal_mask, signo);
+    ::signalfd(m_signal_fd, &m_signal_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    this->restore_signal(signo);
+    lock.unlock();
+
+    Fiber::SetSignalBlocked(signo, false);
+    return 0;
+}
+
+bool IOManager::forward_signal(int signo) noexcept {
+    if(m_signal_pipe[0] == -1) {
+        int fds[2];
+        if(::pipe2(fds, O_NONBLOCK | O_CLOEXEC)) {
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "pipe2() errno=" << errno
+                << " errstr=" << strerror(errno);
+            return false;
+        }
+        ::epoll_event ep_event;
+        ::memset(&ep_event, 0, sizeof(::epoll_event));
+        ep_event.events = EPOLLIN | EPOLLET;
+        ep_event.data.fd = fds[0];
+        if(::epoll_ctl(m_epfd, EPOLL_CTL_ADD, fds[0], &ep_event)) {
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "epoll_ctl(" << m_epfd << ", EPOLL_CTL_ADD, "
+                << fds[0] << ") errno=" << errno << " errstr=" << strerror(errno);
+            ::close(fds[0]);
+            ::close(fds[1]);
+            return false;
+        }
+        m_signal_pipe[0] = fds[0];
+        m_signal_pipe[1] = fds[1];
+    }
+
+    struct ::sigaction action;
+    ::memset(&action, 0, sizeof(action));
+    action.sa_handler = OnSignal;
+    action.sa_flags = SA_RESTART;
+    ::sigemptyset(&action.sa_mask);
+    struct ::sigaction old_action;
+    s_signal_pipes[signo] = m_signal_pipe[1] + 1;
+    if(::sigaction(signo, &action, &old_action)) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "sigaction(" << signo << ") errno=" << errno
+            << " errstr=" << strerror(errno);
+        s_signal_pipes[signo] = 0;
+        return false;
+    }
+    m_signal_actions[signo] = old_action;
+    return true;
+}
+
+void IOManager::restore_signal(int signo) noexcept {
+    auto it = m_signal_actions.find(signo);
+    if(it == m_signal_actions.end())
+        return;
+    ::sigaction(signo, &it->second, nullptr);
+    s_signal_pipes[signo] = 0;
+    m_signal_actions.erase(it);
+}
+
+void IOManager::sync_signal_mask() noexcept {
+    //a fiber run on each spawned worker switches its contexts to the new mask.
+    std::vector<::pid_t> ids;
+    for(size_t i = 0; i < this->get_thread_count(); ++i) {
+        if(this->get_thread_id(i) != GetThreadId())
+            ids.push_back(this->get_thread_id(i));
+    }
+    if(ids.empty())
+        return;
+
+    std::atomic<size_t> left = {ids.size()};
+    Semaphore sem;
+    Fiber::ptr fiber = Scheduler::GetThis() == this ? Fiber::GetThis() : nullptr;
+    for(auto id : ids) {
+        this->schedule([this, &left, &sem, fiber](){
+            if(--left != 0)
+                return;
+            if(fiber)
+                this->schedule(fiber);
+            else
+                sem.notify();
+        }, id);
+    }
+    //a worker fiber parks, its own thread may be one the others wait behind.
+    if(fiber)
+        Fiber::YieldToHold();
+    else
+        sem.wait();
+}
+
+void IOManager::handle_signals() noexcept {
+    ::signalfd_siginfo info;
+    while(::read(m_signal_fd, &info, sizeof(info)) == sizeof(info))
+        this->dispatch_signal(info.ssi_signo);
+}
+
+void IOManager::handle_forwarded_signals() noexcept {
+    uint8_t signos[64];
+    ssize_t n;
+    while((n = ::read(m_signal_pipe[0], signos, sizeof(signos))) > 0) {
+        for(ssize_t i = 0; i < n; ++i)
+            this->dispatch_signal(signos[i]);
+    }
+}
+
+void IOManager::dispatch_signal(int signo) noexcept {
+    Mutex::Lock lock(m_signal_mutex);
+    auto it = m_signal_cbs.find(signo);
+    if(it == m_signal_cbs.end())
+        return;
+    CallBackType cb = it->second;
+    lock.unlock();
+    this->schedule(cb);
+}
+
+void IOManager::set_busy_poll(size_t worker_index, bool flag) noexcept {
+    if(worker_index >= m_workers.size())
+        return;
+    bool old = m_workers[worker_index]->busy_poll.exchange(flag);
+    if(old == flag)
+        return;
+    if(flag)
+        ++m_busy_poll_count;
+    else
+        --m_busy_poll_count;
+    this->tickle();
+}
+
+IOManager::WorkerMetrics IOManager::get_worker_metrics(size_t worker_index) const noexcept {
+    WorkerMetrics metrics;
+    if(worker_index >= m_workers.size())
+        return metrics;
+    WorkerContext* worker = m_workers[worker_index];
+    metrics.busy_poll = worker->busy_poll;
+    metrics.loops = worker->loops;
+    metrics.wakeups = worker->wakeups;
+    metrics.wake_count = worker->wake_count;
+    metrics.wake_latency_total_us = worker->wake_latency_total_us;
+    metrics.wake_latency_max_us = worker->wake_latency_max_us;
+    metrics.wall_us = worker->wall_us;
+    metrics.cpu_us = worker->cpu_us;
+    return metrics;
+}
+
+const Histogram* IOManager::get_loop_histogram(size_t worker_index, LoopHistogram type) const noexcept {
+    if(worker_index >= m_workers.size())
+        return nullptr;
+    return &m_workers[worker_index]->loop_histograms[type];
+}
+
+std::ostream& IOManager::dump_loop_latency(std::ostream& os) const {
+    static const char* names[] = {"event_wait_us", "event_run_us", "timer_process_us"};
+    for(size_t i = 0; i < m_workers.size(); ++i) {
+        for(size_t j = 0; j < 3; ++j) {
+            os << get_name() << "[" << i << "] " << names[j] << ": "
+               << m_workers[i]->loop_histograms[j] << '\n';
+        }
+    }
+    return os;
+}
+
+IOManager::WorkerContext* IOManager::get_worker() const noexcept {
+    size_t index = Scheduler::GetWorkerIndex();
+    if(index >= m_workers.size())
+        return nullptr;
+    return m_workers[index];
+}
+
 void IOManager::init() {
     t_iomanager = this;
 }
@@ -334,11 +696,23 @@ void IOManager::init() {
 void IOManager::tickle() noexcept {
     if(!has_idle_threads())
         return;
+    uint64_t expected = 0;
+    m_tickle_time.compare_exchange_strong(expected, GetMonotonicUS());
+    //busy-poll workers pick up new work without being woken.
+    if(m_busy_poll_count == m_workers.size())
+        return;
     int rt = ::write(m_tickle_fds[1], "T", 1);
     if(UNLIKELY(rt < 0))
         QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "IOManager::tickle() write error";
 }
 
+void IOManager::tickle_thread(::pid_t thread_id) noexcept {
+    if(::syscall(SYS_tgkill, ::getpid(), thread_id, WAKE_SIGNAL)) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "IOManager::tickle_thread(" << thread_id
+            << ") errno=" << errno << " errstr=" << strerror(errno);
+    }
+}
+
 bool IOManager::stopping() noexcept {
     this->timer_manager_stop();
     return (m_pending_event_count == 0
@@ -350,24 +724,54 @@ void IOManager::idle() {
     epoll_event* ep_events = new epoll_event[MAX_EVENT_COUNT];
     QFF_LOG_DEBUG(QFF_LOG_SYSTEM) << "IOManager::idle() start";
     int rt = 0;
-    int next_timeout;
+    uint64_t timeout_us;
     std::vector<Timer::CallBackType> cbs;
+    WorkerContext* worker = this->get_worker();
+    uint64_t start_us = UpdateCachedClock();
+    uint64_t start_cpu_us = GetThreadCpuUS();
+    static const uint64_t MAX_TIMEOUT_US = 5000 * 1000;
     while (!m_is_stopping) {
+        bool busy_poll = worker && worker->busy_poll;
+
+        if(busy_poll) {
+            timeout_us = 0;
+        } else {
+            uint64_t now_us = UpdateCachedClock();
+            uint64_t next_time = this->get_next_time();
+            if(next_time <= now_us)
+                timeout_us = 0;
+            else
+                timeout_us = std::min(next_time - now_us, MAX_TIMEOUT_US);
+        }
+        rt = this->wait_events(worker, ep_events, MAX_EVENT_COUNT, timeout_us);
+        //WAKE_SIGNAL, back to the run queue for the fiber pinned here.
+        if(rt < 0 && errno == EINTR)
+            rt = 0;
+        //one clock read per wakeup, timers and fibers run off the cached time.
+        uint64_t epoll_return_us = UpdateCachedClock();
+
+        if(worker) {
+            uint64_t loops = ++worker->loops;
+            if(rt > 0)
+                ++worker->wakeups;
+            if(m_tickle_time.load(std::memory_order_relaxed)) {
+                uint64_t tickle_time = m_tickle_time.exchange(0);
+                if(tickle_time && epoll_return_us >= tickle_time)
+                    worker->record_wake_latency(epoll_return_us - tickle_time);
+            }
+            //a spinning worker samples its cpu clock less often.
+            if(!busy_poll || rt > 0 || (loops & 0x3f) == 0) {
+                worker->wall_us = epoll_return_us - start_us;
+                worker->cpu_us = GetThreadCpuUS() - start_cpu_us;
+            }
+        }
 
-        do {
-            static const int MAX_TIMEOUT = 5000;
-            next_timeout = this->get_next_time() - GetCurrentMS();
-            next_timeout = next_timeout < MAX_TIMEOUT ? next_timeout : MAX_TIMEOUT;
-            rt = ::epoll_wait(m_epfd, ep_events, MAX_EVENT_COUNT, next_timeout);
-            if(rt < 0 && errno == EINTR)
-                continue;
-            break;
-        }while(true);
-
-        cbs = std::move(this->list_expired_cb());
+        this->list_expired_cb(cbs);
         if(!cbs.empty()) {
             this->schedule(cbs);
             cbs.clear();
+            if(worker)
+                worker->loop_histograms[TIMER_PROCESS].record(GetMonotonicUS() - epoll_return_us);
         }
 
         for(int i = 0; i < rt; ++i) {
@@ -377,6 +781,14 @@ void IOManager::idle() {
                 while(::read(m_tickle_fds[0], dummy, sizeof(dummy)) > 0);
                 continue;
             }
+            if(event.data.fd == m_signal_fd) {
+                this->handle_signals();
+                continue;
+            }
+            if(event.data.fd == m_signal_pipe[0]) {
+                this->handle_forwarded_signals();
+                continue;
+            }
 
             FdContext* fd_ctx = (FdContext*)event.data.ptr;
             FdContext::MutexType::Lock lock(fd_ctx->mutex);
@@ -393,7 +805,9 @@ void IOManager::idle() {
                 real_events |= WRITE;
             }
 
-            if((fd_ctx->events & real_events) == NONE) 
+            //EPOLLERR, e.g. a MSG_ZEROCOPY completion, reports both directions.
+            real_events &= fd_ctx->events;
+            if(real_events == NONE)
                 continue;
             
             int left_event = (fd_ctx->events & ~real_events);
@@ -410,12 +824,12 @@ void IOManager::idle() {
             }
 
             if(real_events & READ) {
-                fd_ctx->trigger_event(READ);
+                fd_ctx->trigger_event(READ, epoll_return_us);
                 --m_pending_event_count;
             }
 
-            if(fd_ctx->events & WRITE) {
-                fd_ctx->trigger_event(WRITE);
+            if(real_events & WRITE) {
+                fd_ctx->trigger_event(WRITE, epoll_return_us);
                 --m_pending_event_count;
             }
         }
@@ -426,8 +840,94 @@ void IOManager::idle() {
     delete[] ep_events;
 }
 
+int IOManager::wait_events(WorkerContext* worker, epoll_event* events
+                        , int max_events, uint64_t timeout_us) noexcept {
+    ::sigset_t wait_mask;
+    ::pthread_sigmask(SIG_BLOCK, nullptr, &wait_mask);
+    ::sigdelset(&wait_mask, WAKE_SIGNAL);
+    if(m_epoll_pwait2.load(std::memory_order_relaxed)) {
+        ::timespec ts;
+        ts.tv_sec = timeout_us / (1000 * 1000);
+        ts.tv_nsec = timeout_us % (1000 * 1000) * 1000;
+        int rt = ::syscall(__NR_epoll_pwait2, m_epfd, events, max_events, &ts, &wait_mask, _NSIG / 8);
+        if(rt >= 0 || (errno != ENOSYS && errno != EPERM))
+            return rt;
+        //refused after the probe passed, a filter installed later.
+        if(m_epoll_pwait2.exchange(false)) {
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "epoll_pwait2 errno=" << errno
+                << " errstr=" << strerror(errno) << ", falling back to epoll_wait";
+        }
+    }
+
+    if(timeout_us % 1000 == 0 || !worker || !this->init_wait_fd(worker))
+        return ::epoll_pwait(m_epfd, events, max_events, (timeout_us + 999) / 1000, &wait_mask);
+    //sleep the whole milliseconds first, the remainder is left for the next loop.
+    if(timeout_us >= 1000)
+        return ::epoll_pwait(m_epfd, events, max_events, timeout_us / 1000, &wait_mask);
+
+    //below a millisecond, block on a private epoll holding the shared one and a timerfd.
+    ::itimerspec its;
+    ::memset(&its, 0, sizeof(its));
+    its.it_value.tv_nsec = timeout_us * 1000;
+    ::timerfd_settime(worker->timer_fd, 0, &its, nullptr);
+    epoll_event ready[2];
+    int rt = ::epoll_pwait(worker->wait_fd, ready, 2, -1, &wait_mask);
+    if(rt < 0)
+        return rt;
+    uint64_t expirations;
+    while(::read(worker->timer_fd, &expirations, sizeof(expirations)) > 0);
+    return ::epoll_wait_f(m_epfd, events, max_events, 0);
+}
+
+bool IOManager::init_wait_fd(WorkerContext* worker) noexcept {
+    if(worker->wait_fd >= 0)
+        return true;
+    //-2 marks a failed setup, such workers round up to milliseconds.
+    if(worker->timer_fd == -2)
+        return false;
+
+    worker->timer_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    worker->wait_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    bool ok = worker->timer_fd >= 0 && worker->wait_fd >= 0;
+    if(ok) {
+        ::epoll_event event;
+        ::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = m_epfd;
+        ok = ::epoll_ctl(worker->wait_fd, EPOLL_CTL_ADD, m_epfd, &event) == 0;
+        event.data.fd = worker->timer_fd;
+        ok = ok && ::epoll_ctl(worker->wait_fd, EPOLL_CTL_ADD, worker->timer_fd, &event) == 0;
+    }
+    if(ok)
+        return true;
+
+    QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "IOManager::init_wait_fd() fail, errno=" << errno
+        << " (" << strerror(errno) << ")";
+    if(worker->wait_fd >= 0)
+        ::close(worker->wait_fd);
+    if(worker->timer_fd >= 0)
+        ::close(worker->timer_fd);
+    worker->wait_fd = -1;
+    worker->timer_fd = -2;
+    return false;
+}
+
+void IOManager::on_event_fiber_run(uint64_t wait_us, uint64_t run_us) noexcept {
+    WorkerContext* worker = this->get_worker();
+    if(!worker)
+        return;
+    worker->loop_histograms[EVENT_WAIT].record(wait_us);
+    worker->loop_histograms[EVENT_RUN].record(run_us);
+}
+
 void IOManager::on_timer_inserted_into_front() noexcept {
     this->tickle();
 }
 
+size_t IOManager::get_timer_shard_index() const noexcept {
+    if(Scheduler::GetThis() != this)
+        return -1;
+    return Scheduler::GetWorkerIndex();
+}
+
 } // namespace qff
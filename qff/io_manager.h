@@ -3,10 +3,14 @@
 
 #include <memory>
 #include <variant>
+#include <map>
+#include <signal.h>
+#include <sys/epoll.h>
 
 #include "scheduler.h"
 #include "timer.h"
 #include "hook.h"
+#include "histogram.h"
 
 namespace qff {
 
@@ -22,6 +26,26 @@ public:
         READ  = 0x1,
         WRITE = 0x4,
     };
+
+    struct WorkerMetrics {
+        bool busy_poll = false;
+        uint64_t loops = 0;
+        uint64_t wakeups = 0;
+        uint64_t wake_count = 0;
+        uint64_t wake_latency_total_us = 0;
+        uint64_t wake_latency_max_us = 0;
+        uint64_t wall_us = 0;
+        uint64_t cpu_us = 0;
+
+        double cpu_usage() const noexcept { return wall_us ? (double)cpu_us / wall_us : 0; }
+        uint64_t wake_latency_avg_us() const noexcept { return wake_count ? wake_latency_total_us / wake_count : 0; }
+    };
+
+    enum LoopHistogram {
+        EVENT_WAIT    = 0,  //epoll_wait returned -> triggered fiber resumed
+        EVENT_RUN     = 1,  //triggered fiber resumed -> yielded again
+        TIMER_PROCESS = 2   //expired timers collected and scheduled, per loop
+    };
 private:
     struct EventContext {
         typedef std::function<void()> CallBackType;
@@ -41,11 +65,30 @@ private:
 
         int fd = 0;
         EventType events = NONE;
+        bool busy_poll_set = false;
 
         MutexType mutex;
 
         EventContext& get_context(EventType event) noexcept;
-        void trigger_event(EventType event);
+        void trigger_event(EventType event, uint64_t ready_time = 0);
+    };
+
+    struct WorkerContext {
+        std::atomic<bool> busy_poll = {false};
+        std::atomic<uint64_t> loops = {0};
+        std::atomic<uint64_t> wakeups = {0};
+        std::atomic<uint64_t> wake_count = {0};
+        std::atomic<uint64_t> wake_latency_total_us = {0};
+        std::atomic<uint64_t> wake_latency_max_us = {0};
+        std::atomic<uint64_t> wall_us = {0};
+        std::atomic<uint64_t> cpu_us = {0};
+        Histogram loop_histograms[3];
+        //sub-millisecond sleeps without epoll_pwait2, see wait_events().
+        int timer_fd = -1;
+        int wait_fd = -1;
+
+        ~WorkerContext() noexcept;
+        void record_wake_latency(uint64_t us) noexcept;
     };
 public:
     static IOManager* GetThis();
@@ -54,25 +97,76 @@ public:
     ~IOManager() noexcept;
 
     int add_event(int fd, EventType event, CallBackType cb = nullptr) noexcept;
+    //removes the event without triggering it, -1 if it is not registered.
     int del_event(int fd, EventType event) noexcept;
 
     int cancel_event(int fd, EventType event) noexcept;
     int cancel_all(int fd) noexcept;
+
+    //signo is blocked and read from a signalfd, cb runs as an ordinary scheduled callback.
+    //returns once the calling thread and every spawned worker block it. other threads,
+    //e.g. the main one, that still let it through run a handler passing it on to the
+    //IOManager. the previous action comes back with del_signal or the destructor.
+    //SIGURG is refused, see tickle_thread().
+    int add_signal(int signo, CallBackType cb) noexcept;
+    int del_signal(int signo) noexcept;
+
+    //a fiber parked on work outside the epoll set keeps the IOManager from stopping.
+    void hold_pending() noexcept { ++m_pending_event_count; }
+    void release_pending() noexcept { --m_pending_event_count; }
+
+    //a busy-poll worker never sleeps in epoll_wait, it spins on the run queue instead.
+    void set_busy_poll(size_t worker_index, bool flag) noexcept;
+    //SO_BUSY_POLL value applied to sockets registered from now on, 0 disables it.
+    void set_busy_poll_sockets(int usec) noexcept { m_busy_poll_usec = usec; }
+    WorkerMetrics get_worker_metrics(size_t worker_index) const noexcept;
+    const Histogram* get_loop_histogram(size_t worker_index, LoopHistogram type) const noexcept;
+    std::ostream& dump_loop_latency(std::ostream& os) const;
 private:
     void contexts_resize(size_t size) noexcept;
+    WorkerContext* get_worker() const noexcept;
+    //returns once every spawned worker runs with the signals blocked.
+    void sync_signal_mask() noexcept;
+    void handle_signals() noexcept;
+    void handle_forwarded_signals() noexcept;
+    void dispatch_signal(int signo) noexcept;
+    //installs the handler for threads that do not block signo.
+    bool forward_signal(int signo) noexcept;
+    void restore_signal(int signo) noexcept;
+    //waits with microsecond resolution, on epoll_pwait2 when the kernel has it.
+    int wait_events(WorkerContext* worker, epoll_event* events, int max_events, uint64_t timeout_us) noexcept;
+    bool init_wait_fd(WorkerContext* worker) noexcept;
 protected:
     void init() override;
     void tickle() noexcept override;
+    //sends SIGURG to the worker, let through only while it waits in epoll. the first
+    //IOManager installs a handler ignoring these wakes and passing any other SIGURG to
+    //the action it replaced, the last one destroyed puts that action back. an action
+    //installed later by the application breaks the wakes.
+    void tickle_thread(::pid_t thread_id) noexcept override;
     bool stopping() noexcept override;
     void idle() override;
 
+    void on_event_fiber_run(uint64_t wait_us, uint64_t run_us) noexcept override;
     void on_timer_inserted_into_front() noexcept override;
+    size_t get_timer_shard_index() const noexcept override;
 private:
     int m_epfd = -1;
+    std::atomic<bool> m_epoll_pwait2 = {false};
     int m_tickle_fds[2];
     std::atomic<size_t> m_pending_event_count = {0};
     RWMutexType m_mutex;
     std::vector<FdContext*> m_fd_contexts;
+    std::vector<WorkerContext*> m_workers;
+    std::atomic<size_t> m_busy_poll_count = {0};
+    std::atomic<int> m_busy_poll_usec = {0};
+    std::atomic<uint64_t> m_tickle_time = {0};
+    int m_signal_fd = -1;
+    ::sigset_t m_signal_mask;
+    std::map<int, CallBackType> m_signal_cbs;
+    int m_signal_pipe[2] = {-1, -1};
+    std::map<int, struct ::sigaction> m_signal_actions;
+    Mutex m_signal_mutex;
 };
 
 } // namespace qff
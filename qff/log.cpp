@@ -1,4 +1,5 @@
 #include "log.h"
+#include "hook.h"
 
 #include <algorithm>
 #include <iostream>
@@ -64,7 +65,11 @@ FileLogAppender::~FileLogAppender() {
 
 void FileLogAppender::output(const std::string& str) {
 	MutexType::Lock mutex(m_mutex);
+	//the write must not park the fiber while the mutex is held.
+	bool hook_enable = is_hook_enable();
+	set_hook_enable(false);
 	m_ofs << str << std::endl;
+	set_hook_enable(hook_enable);
 }
 
 StandLogAppender::StandLogAppender(const std::string& name
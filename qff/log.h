@@ -9,6 +9,7 @@
 #include <fstream>
 
 #include "utils.h"
+#include "clock.h"
 #include "macro.h"
 #include "singleton.h"
 #include "thread.h"
@@ -27,7 +28,7 @@
 #define QFF_LOG_EVENT(LEVEL)	\
 	std::make_shared<qff::LogEvent>(qff::GetThreadName(), 			\
 			 ::qff::GetThreadId(), ::qff::GetFiberId(), qff::LogLevel::LEVEL 		\
-					,__FILE__, __LINE__, time(0))
+					,__FILE__, __LINE__, qff::GetCachedWallTime())
 
 #define QFF_LOG_DEBUG(LOGGER)														\
 	qff::LogEventManager(QFF_LOG_EVENT(DEBUG), LOGGER).get_SS()
@@ -0,0 +1,428 @@
+#include "prefix_table.h"
+#include "log.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+namespace qff {
+
+typedef unsigned __int128 uint128_t;
+
+//slots keep a flag below the node index, so indexes have 31 bits.
+static const uint32_t NIL = 0x7fffffff;
+//the slot table grows with the prefix count, 8M at most.
+static const int MIN_TABLE_BITS = 8;
+static const int MAX_TABLE_BITS = 20;
+
+static inline int CountLeadingZeros(uint32_t v) { return v ? __builtin_clz(v) : 32;}
+static inline int CountLeadingZeros(uint128_t v) {
+    uint64_t hi = v >> 64;
+    uint64_t lo = v;
+    return hi ? __builtin_clzll(hi) : lo ? 64 + __builtin_clzll(lo) : 128;
+}
+
+//lookups run inside an RcuReadSection. a load swaps the tries and waits until
+//every reader has left or entered after the swap before freeing the old ones.
+//one record per thread is enough, lookups never yield to another fiber.
+struct RcuReader {
+    alignas(64) std::atomic<uint64_t> epoch = {0};
+};
+
+static Mutex s_rcu_mutex;
+static std::vector<RcuReader*> s_rcu_readers;
+static std::atomic<uint64_t> s_rcu_epoch = {1};
+
+struct RcuThread {
+    RcuReader* reader;
+
+    RcuThread() : reader(new RcuReader) {
+        Mutex::Lock lock(s_rcu_mutex);
+        s_rcu_readers.push_back(reader);
+    }
+    ~RcuThread() {
+        Mutex::Lock lock(s_rcu_mutex);
+        s_rcu_readers.erase(std::find(s_rcu_readers.begin(), s_rcu_readers.end(), reader));
+        delete reader;
+    }
+};
+
+static thread_local RcuThread t_rcu_thread;
+
+class RcuReadSection final {
+public:
+    RcuReadSection() : m_reader(t_rcu_thread.reader) {
+        m_reader->epoch.store(s_rcu_epoch.load(std::memory_order_relaxed));
+    }
+    ~RcuReadSection() {
+        m_reader->epoch.store(0, std::memory_order_release);
+    }
+private:
+    RcuReader* m_reader;
+};
+
+static void RcuSynchronize() {
+    uint64_t target = s_rcu_epoch.fetch_add(1) + 1;
+    while(true) {
+        bool quiet = true;
+        {
+            Mutex::Lock lock(s_rcu_mutex);
+            for(auto i : s_rcu_readers) {
+                uint64_t epoch = i->epoch.load(std::memory_order_acquire);
+                if(epoch && epoch < target) {
+                    quiet = false;
+                    break;
+                }
+            }
+        }
+        if(quiet)
+            return;
+        ::sched_yield();
+    }
+}
+
+//prefixes no longer than the table bits are pushed down into the slots, the
+//longer ones live in a path compressed binary trie that the slots point into.
+template<class Key>
+class LpmTrie {
+public:
+    static const int BITS = sizeof(Key) * 8;
+
+    struct Entry {
+        Key prefix;
+        uint8_t len;
+        PrefixTable::Value value;
+    };
+
+    //entries are sorted in place.
+    void build(std::vector<Entry>& entries);
+
+    bool lookup(Key key, PrefixTable::Value& value) const {
+        if(m_slots.empty())
+            return false;
+        const Slot& slot = m_slots[key >> (BITS - m_table_bits)];
+        bool found = slot.node & 1;
+        PrefixTable::Value best = slot.value;
+        uint32_t index = slot.node >> 1;
+        while(index != NIL) {
+            const Node& node = m_nodes[index];
+            if((key & Mask(node.len)) != node.prefix)
+                break;
+            if(node.has_value) {
+                best = node.value;
+                found = true;
+            }
+            if(node.len == BITS)
+                break;
+            index = node.child[Bit(key, node.len)];
+        }
+        if(found)
+            value = best;
+        return found;
+    }
+
+    size_t get_count() const noexcept { return m_count;}
+    size_t get_memory() const noexcept {
+        return m_nodes.capacity() * sizeof(Node) + m_slots.capacity() * sizeof(Slot);
+    }
+private:
+    struct Node {
+        Key prefix;
+        uint32_t child[2];
+        PrefixTable::Value value;
+        uint8_t len;
+        bool has_value;
+    };
+    //the first trie node below the slot shifted left by one, the low bit is
+    //set when value holds the longest prefix covering the whole slot.
+    struct Slot {
+        uint32_t node;
+        PrefixTable::Value value;
+    };
+
+    static Key Mask(int len) { return len ? ~(Key)0 << (BITS - len) : 0;}
+    static int Bit(Key key, int pos) { return (key >> (BITS - 1 - pos)) & 1;}
+
+    uint32_t add_node(Key prefix, int len, bool has_value, PrefixTable::Value value) {
+        m_nodes.push_back({prefix, {NIL, NIL}, value, (uint8_t)len, has_value});
+        return m_nodes.size() - 1;
+    }
+    void insert(const Entry& entry);
+private:
+    std::vector<Node> m_nodes;
+    std::vector<Slot> m_slots;
+    uint32_t m_root = NIL;
+    int m_table_bits = MIN_TABLE_BITS;
+    size_t m_count = 0;
+};
+
+template<class Key>
+void LpmTrie<Key>::build(std::vector<Entry>& entries) {
+    for(auto& i : entries)
+        i.prefix &= Mask(i.len);
+    //shortest first so longer prefixes overwrite the slots, a later duplicate overwrites an earlier one.
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.len != b.len ? a.len < b.len : a.prefix < b.prefix;
+    });
+    m_count = 0;
+    for(size_t i = 0; i < entries.size(); ++i) {
+        if(i + 1 == entries.size() || entries[i].len != entries[i + 1].len
+                || entries[i].prefix != entries[i + 1].prefix)
+            ++m_count;
+    }
+    if(entries.empty())
+        return;
+
+    m_table_bits = MIN_TABLE_BITS;
+    while(m_table_bits < MAX_TABLE_BITS && ((size_t)1 << m_table_bits) < m_count)
+        ++m_table_bits;
+    m_slots.assign((size_t)1 << m_table_bits, {NIL << 1, 0});
+    size_t deep = 0;
+    for(auto& i : entries) {
+        if(i.len > m_table_bits) {
+            ++deep;
+            continue;
+        }
+        size_t first = i.prefix >> (BITS - m_table_bits);
+        size_t last = first + ((size_t)1 << (m_table_bits - i.len));
+        for(size_t j = first; j < last; ++j) {
+            m_slots[j].node |= 1;
+            m_slots[j].value = i.value;
+        }
+    }
+
+    //every insert adds at most two nodes, reserving keeps the links valid.
+    m_nodes.reserve(deep * 2);
+    for(auto& i : entries) {
+        if(i.len > m_table_bits)
+            this->insert(i);
+    }
+    for(size_t i = 0; i < m_slots.size(); ++i) {
+        //nodes shorter than the slot only branch, they never hold a value.
+        Key key = (Key)i << (BITS - m_table_bits);
+        uint32_t index = m_root;
+        while(index != NIL && m_nodes[index].len < m_table_bits) {
+            const Node& node = m_nodes[index];
+            index = (key & Mask(node.len)) == node.prefix ? node.child[Bit(key, node.len)] : NIL;
+        }
+        if(index != NIL)
+            m_slots[i].node = (index << 1) | (m_slots[i].node & 1);
+    }
+}
+
+template<class Key>
+void LpmTrie<Key>::insert(const Entry& entry) {
+    uint32_t* link = &m_root;
+    while(true) {
+        if(*link == NIL) {
+            *link = this->add_node(entry.prefix, entry.len, true, entry.value);
+            return;
+        }
+        Node& node = m_nodes[*link];
+        int common = std::min<int>(std::min(entry.len, node.len),
+                                   CountLeadingZeros(entry.prefix ^ node.prefix));
+        if(common == node.len && common == entry.len) {
+            node.value = entry.value;
+            node.has_value = true;
+            return;
+        }
+        if(common == node.len) {
+            link = &node.child[Bit(entry.prefix, node.len)];
+            continue;
+        }
+        uint32_t old = *link;
+        Key old_prefix = node.prefix;
+        uint32_t parent;
+        if(common == entry.len) {
+            parent = this->add_node(entry.prefix, entry.len, true, entry.value);
+        } else {
+            parent = this->add_node(entry.prefix & Mask(common), common, false, 0);
+            m_nodes[parent].child[Bit(entry.prefix, common)]
+                = this->add_node(entry.prefix, entry.len, true, entry.value);
+        }
+        m_nodes[parent].child[Bit(old_prefix, common)] = old;
+        *link = parent;
+        return;
+    }
+}
+
+struct PrefixTable::Tries {
+    LpmTrie<uint32_t> v4;
+    LpmTrie<uint128_t> v6;
+};
+
+static uint32_t LoadV4(const uint8_t addr[4]) {
+    uint32_t key;
+    memcpy(&key, addr, sizeof(key));
+    return ntohl(key);
+}
+
+static uint128_t LoadV6(const uint8_t addr[16]) {
+    uint128_t key = 0;
+    for(int i = 0; i < 16; ++i)
+        key = (key << 8) | addr[i];
+    return key;
+}
+
+//decimal digits only, no sign or blanks, and at most max.
+static bool ParseNumber(const std::string& str, unsigned long max, unsigned long& number) {
+    if(str.empty() || !isdigit((unsigned char)str[0]))
+        return false;
+    char* end;
+    errno = 0;
+    number = strtoul(str.c_str(), &end, 10);
+    return !*end && errno != ERANGE && number <= max;
+}
+
+int PrefixTable::Builder::add(const SockAddr& network, uint32_t prefix_len, Value value) {
+    Entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.family = network.get_family();
+    entry.value = value;
+    if(entry.family == AF_INET && prefix_len <= 32) {
+        memcpy(entry.addr, &((const sockaddr_in*)network.get_addr())->sin_addr, 4);
+    } else if(entry.family == AF_INET6 && prefix_len <= 128) {
+        memcpy(entry.addr, &((const sockaddr_in6*)network.get_addr())->sin6_addr, 16);
+    } else {
+        return -1;
+    }
+    entry.len = prefix_len;
+    m_entries.push_back(entry);
+    return 0;
+}
+
+int PrefixTable::Builder::add(std::string_view cidr, Value value) {
+    size_t slash = cidr.find('/');
+    SockAddr network;
+    if(!SockAddr::Parse(cidr.substr(0, slash), 0, network))
+        return -1;
+    uint32_t len = network.get_family() == AF_INET ? 32 : 128;
+    if(slash != std::string_view::npos) {
+        unsigned long bits;
+        if(!ParseNumber(std::string(cidr.substr(slash + 1)), len, bits))
+            return -1;
+        len = bits;
+    }
+    return this->add(network, len, value);
+}
+
+int PrefixTable::Builder::load_file(const std::string& path) {
+    std::ifstream ifs;
+    if(!FSUtils::OpenForRead(ifs, path, std::ios::in)) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "PrefixTable load " << path << " failed";
+        return -1;
+    }
+
+    int count = 0;
+    size_t number = 0;
+    std::string line;
+    while(std::getline(ifs, line)) {
+        ++number;
+        size_t comment = line.find('#');
+        if(comment != std::string::npos)
+            line.resize(comment);
+        std::istringstream iss(line);
+        std::string cidr;
+        if(!(iss >> cidr))
+            continue;
+        unsigned long value = 0;
+        std::string word;
+        if(iss >> word && !ParseNumber(word, std::numeric_limits<Value>::max(), value)) {
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "PrefixTable " << path << ":" << number
+                << " bad value '" << word << "'";
+            return -1;
+        }
+        if(iss >> word || this->add(cidr, value)) {
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "PrefixTable " << path << ":" << number
+                << " bad prefix '" << line << "'";
+            return -1;
+        }
+        ++count;
+    }
+    return count;
+}
+
+PrefixTable::PrefixTable()
+    :m_tries(new Tries) {
+}
+
+PrefixTable::~PrefixTable() noexcept {
+    delete m_tries.load();
+}
+
+void PrefixTable::load(const Builder& builder) {
+    std::vector<LpmTrie<uint32_t>::Entry> v4;
+    std::vector<LpmTrie<uint128_t>::Entry> v6;
+    for(auto& i : builder.m_entries) {
+        if(i.family == AF_INET)
+            v4.push_back({LoadV4(i.addr), i.len, i.value});
+        else
+            v6.push_back({LoadV6(i.addr), i.len, i.value});
+    }
+    Tries* tries = new Tries;
+    tries->v4.build(v4);
+    tries->v6.build(v6);
+
+    Mutex::Lock lock(m_load_mutex);
+    Tries* old = m_tries.exchange(tries);
+    RcuSynchronize();
+    delete old;
+}
+
+int PrefixTable::load_file(const std::string& path) {
+    Builder builder;
+    if(builder.load_file(path) < 0)
+        return -1;
+    this->load(builder);
+    return this->get_count();
+}
+
+bool PrefixTable::lookup(const SockAddr& addr, Value& value) const {
+    switch(addr.get_family()) {
+        case AF_INET:
+            return this->lookup_v4(ntohl(((const sockaddr_in*)addr.get_addr())->sin_addr.s_addr), value);
+        case AF_INET6: {
+            const uint8_t* v6 = ((const sockaddr_in6*)addr.get_addr())->sin6_addr.s6_addr;
+            //::ffff:0:0/96, an ipv4 peer of a dual stack socket.
+            static const uint8_t V4_MAPPED[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+            if(!memcmp(v6, V4_MAPPED, sizeof(V4_MAPPED)))
+                return this->lookup_v4(LoadV4(v6 + 12), value);
+            return this->lookup_v6(v6, value);
+        }
+        default:
+            return false;
+    }
+}
+
+bool PrefixTable::lookup_v4(uint32_t addr, Value& value) const {
+    RcuReadSection section;
+    return m_tries.load()->v4.lookup(addr, value);
+}
+
+bool PrefixTable::lookup_v6(const uint8_t addr[16], Value& value) const {
+    uint128_t key = LoadV6(addr);
+    RcuReadSection section;
+    return m_tries.load()->v6.lookup(key, value);
+}
+
+size_t PrefixTable::get_count() const {
+    RcuReadSection section;
+    const Tries* tries = m_tries.load();
+    return tries->v4.get_count() + tries->v6.get_count();
+}
+
+size_t PrefixTable::get_memory() const {
+    RcuReadSection section;
+    const Tries* tries = m_tries.load();
+    return sizeof(Tries) + tries->v4.get_memory() + tries->v6.get_memory();
+}
+
+} // namespace qff
@@ -0,0 +1,83 @@
+#ifndef __QFF_PREFIX_TABLE_H__
+#define __QFF_PREFIX_TABLE_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "address.h"
+#include "macro.h"
+#include "thread.h"
+
+namespace qff {
+
+//longest prefix match over ipv4 and ipv6 networks, for acls and routing.
+//the top 8 to 20 bits, more for more prefixes, index a flat table and a path
+//compressed binary trie below it holds the longer prefixes. lookups take no
+//lock and never wait for a load, which builds new tries and swaps them in,
+//freeing the old ones once no lookup can still be reading them.
+class PrefixTable final {
+public:
+    NONECOPYABLE(PrefixTable);
+    typedef std::shared_ptr<PrefixTable> ptr;
+    typedef uint32_t Value;
+
+    //collects the prefixes of one load, a later duplicate wins.
+    class Builder final {
+    friend PrefixTable;
+    public:
+        //host bits of network are cleared. returns -1 on a family other than
+        //ipv4 and ipv6 or a prefix_len longer than the address.
+        int add(const SockAddr& network, uint32_t prefix_len, Value value = 0);
+        //"10.0.0.0/8" or "2001:db8::/32", a bare address adds a host route.
+        int add(std::string_view cidr, Value value = 0);
+        //one "cidr [value]" per line, '#' starts a comment and the value, decimal and
+        //below 2^32, defaults to 0. returns the prefixes read or -1 on an unreadable
+        //file or line.
+        int load_file(const std::string& path);
+
+        size_t get_count() const noexcept { return m_entries.size();}
+        void clear() noexcept { m_entries.clear();}
+    private:
+        struct Entry {
+            int family;
+            uint8_t len;
+            //network byte order, ipv4 uses the first four.
+            uint8_t addr[16];
+            Value value;
+        };
+        std::vector<Entry> m_entries;
+    };
+
+    PrefixTable();
+    //no lookup may run anymore.
+    ~PrefixTable() noexcept;
+
+    //swaps in the prefixes of builder and returns once the old tries are freed.
+    //loads are serialized, lookups go on meanwhile.
+    void load(const Builder& builder);
+    //returns the prefixes loaded or -1, the current prefixes stay then.
+    int load_file(const std::string& path);
+
+    //the value of the longest prefix covering addr, false when none does.
+    //ipv4-mapped ipv6 addresses are looked up among the ipv4 prefixes.
+    bool lookup(const SockAddr& addr, Value& value) const;
+    //address in host order.
+    bool lookup_v4(uint32_t addr, Value& value) const;
+    //address in network byte order.
+    bool lookup_v6(const uint8_t addr[16], Value& value) const;
+
+    //distinct prefixes loaded.
+    size_t get_count() const;
+    //bytes used by the tries.
+    size_t get_memory() const;
+private:
+    struct Tries;
+    std::atomic<Tries*> m_tries;
+    Mutex m_load_mutex;
+};
+
+} // namespace qff
+
+#endif
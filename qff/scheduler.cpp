@@ -1,41 +1,49 @@
 #include "scheduler.h"
 
 #include <assert.h>
+#include <algorithm>
 
 #include "utils.h"
+#include "clock.h"
 #include "log.h"
 
 namespace qff {
     
 static thread_local Scheduler* t_scheduler = nullptr;
 static thread_local Fiber* t_cache_fiber = nullptr;
+static thread_local size_t t_worker_index = -1;
 
 void Scheduler::FiberAndThread::clear() {
     fiber.reset();
     thread_id = -1;
+    ready_time = 0;
 }
 
 Scheduler::FiberAndThread::FiberAndThread() noexcept {
 }
 
-Scheduler::FiberAndThread::FiberAndThread(Fiber::ptr fib, ::pid_t id) noexcept 
+Scheduler::FiberAndThread::FiberAndThread(Fiber::ptr fib, ::pid_t id, uint64_t ready) noexcept 
     :fiber(fib)
-    ,thread_id(id) {
+    ,thread_id(id)
+    ,ready_time(ready) {
 }
 
-Scheduler::FiberAndThread::FiberAndThread(CallBackType cb, ::pid_t id) noexcept 
-    :thread_id(id) {
+Scheduler::FiberAndThread::FiberAndThread(CallBackType cb, ::pid_t id, uint64_t ready) noexcept 
+    :thread_id(id)
+    ,ready_time(ready) {
     fiber = std::make_shared<Fiber>(cb);
 }
 
 Scheduler::FiberAndThread::FiberAndThread(const Scheduler::FiberAndThread& fat) noexcept {
     fiber = fat.fiber;
     thread_id = fat.thread_id;
+    ready_time = fat.ready_time;
 }
 
 Scheduler::FiberAndThread& Scheduler::FiberAndThread::operator=(const FiberAndThread& fat) {
     fiber = fat.fiber;
     thread_id = fat.thread_id;
+    ready_time = fat.ready_time;
     return *this;
 }
 
@@ -43,6 +51,10 @@ Scheduler* Scheduler::GetThis() {
     return t_scheduler;
 }
 
+size_t Scheduler::GetWorkerIndex() noexcept {
+    return t_worker_index;
+}
+
 Fiber* Scheduler::GetCacheFiber() noexcept {
     return t_cache_fiber;
 }
@@ -57,7 +69,7 @@ Scheduler::Scheduler(size_t thread_count, const std::string& name, bool use_call
         assert(t_scheduler == nullptr);
         t_scheduler = this;
 
-        auto func = std::bind(&Scheduler::run, this);
+        auto func = std::bind(&Scheduler::run, this, 0);
         m_root_fiber 
             = std::make_shared<Fiber>(func, 1024*1024, true);
         Thread::SetName(m_name);
@@ -88,8 +100,9 @@ void Scheduler::start() {
     assert(m_thread_pool.empty());
     m_thread_pool.resize(m_thread_count);
 
-    auto func = std::bind(&Scheduler::run, this);
+    size_t first_index = m_root_fiber ? 1 : 0;
     for(size_t i = 0; i < m_thread_count; ++i) {
+        auto func = std::bind(&Scheduler::run, this, first_index + i);
         Thread::ptr thread 
             = std::make_shared<Thread>(func, m_name+'_'+std::to_string(i));
         m_thread_pool[i] = thread;
@@ -116,31 +129,54 @@ void Scheduler::stop() noexcept {
     m_is_stop = true;
 }
 
-void Scheduler::schedule(Fiber::ptr fiber, pid_t thread_id) {
+::pid_t Scheduler::get_pinned_thread(const Fiber::ptr& fiber) noexcept {
+    ::pid_t id = fiber->m_thread_id;
+    if(id == -1 || std::find(m_thread_ids.begin(), m_thread_ids.end(), id) != m_thread_ids.end())
+        return id;
+    //pinned by another scheduler, none of our threads would ever run it.
+    fiber->m_thread_id = -1;
+    return -1;
+}
+
+void Scheduler::schedule(Fiber::ptr fiber, pid_t thread_id, uint64_t ready_time) {
+    if(thread_id == -1)
+        thread_id = this->get_pinned_thread(fiber);
     MutexType::Lock lock(m_mutex);
     bool need_tickle = m_fiber_list.empty();
-    m_fiber_list.emplace_back(fiber, thread_id);
+    m_fiber_list.emplace_back(fiber, thread_id, ready_time);
     lock.unlock();
-    if(need_tickle) 
+    if(thread_id != -1 && thread_id != GetThreadId())
+        this->tickle_thread(thread_id);
+    else if(need_tickle) 
         this->tickle();
 }
 
-void Scheduler::schedule(CallBackType cb, pid_t thread_id) {
+void Scheduler::schedule(CallBackType cb, pid_t thread_id, uint64_t ready_time) {
     MutexType::Lock lock(m_mutex);
     bool need_tickle = m_fiber_list.empty();
-    m_fiber_list.emplace_back(cb, thread_id);
+    m_fiber_list.emplace_back(cb, thread_id, ready_time);
     lock.unlock();
-    if(need_tickle) 
+    if(thread_id != -1 && thread_id != GetThreadId())
+        this->tickle_thread(thread_id);
+    else if(need_tickle) 
         this->tickle();
 }
 
 void Scheduler::schedule(const std::vector<Fiber::ptr>& fibs) {
+    std::vector<::pid_t> ids;
+    ids.reserve(fibs.size());
+    for(const auto& i : fibs)
+        ids.push_back(this->get_pinned_thread(i));
     MutexType::Lock lock(m_mutex);
     bool need_tickle = m_fiber_list.empty();
-    for(const auto& i : fibs) {
-        m_fiber_list.emplace_back(i);
+    for(size_t i = 0; i < fibs.size(); ++i) {
+        m_fiber_list.emplace_back(fibs[i], ids[i]);
     }
     lock.unlock();
+    for(auto id : ids) {
+        if(id != -1 && id != GetThreadId())
+            this->tickle_thread(id);
+    }
     if(need_tickle) 
         this->tickle();
 }
@@ -164,6 +200,10 @@ void Scheduler::tickle() {
     QFF_LOG_INFO(QFF_LOG_SYSTEM) << "scheduler::tickle()";
 }
 
+void Scheduler::tickle_thread(::pid_t thread_id) {
+    this->tickle();
+}
+
 bool Scheduler::stopping() {
     QFF_LOG_INFO(QFF_LOG_SYSTEM) << "scheduler::stopping()";
     return true;
@@ -176,14 +216,16 @@ void Scheduler::idle() {
     }
 }
 
-void Scheduler::run() {
+void Scheduler::run(size_t worker_index) {
     t_scheduler = this;
+    t_worker_index = worker_index;
     Fiber::Init();
     this->init();
     auto func = std::bind(&Scheduler::idle, this);
     Fiber::ptr idle_fiber = std::make_shared<Fiber>(func);
     FiberAndThread ft;
     bool tick_me;
+    bool drained;
     MutexType::Lock lock(m_mutex, false);
     while(true) {
         ft.clear();
@@ -193,10 +235,9 @@ void Scheduler::run() {
         auto it = m_fiber_list.begin();
         for(;it != m_fiber_list.end(); ++it) {
             pid_t id = it->thread_id;
-            if(id != -1 && id != GetThreadId()) {
-                tick_me = true;
+            //its worker was woken by schedule().
+            if(id != -1 && id != GetThreadId())
                 continue;
-            }
 
             assert(it->fiber);
             if(it->fiber->m_state == Fiber::EXEC)
@@ -204,9 +245,13 @@ void Scheduler::run() {
             
             ft = *it;
             m_fiber_list.erase(it++);
+            //a fiber pinned once stays on its thread across parks.
+            if(id != -1)
+                ft.fiber->m_thread_id = id;
             break;
         }
         tick_me |= it != m_fiber_list.end();
+        drained = m_fiber_list.empty();
         lock.unlock();
 
         if(ft.fiber) {
@@ -218,13 +263,20 @@ void Scheduler::run() {
 
         if(ft.fiber && ft.fiber->m_state != Fiber::TERM 
             && ft.fiber->m_state != Fiber::EXCEPT) {
+            uint64_t resume_time = ft.ready_time ? GetMonotonicUS() : 0;
             ft.fiber->swap_in();
             --m_active_thread_count;
+            if(ft.ready_time) {
+                uint64_t wait_us = resume_time > ft.ready_time ? resume_time - ft.ready_time : 0;
+                this->on_event_fiber_run(wait_us, GetMonotonicUS() - resume_time);
+            }
             if(ft.fiber->m_state == Fiber::READY)
                 this->schedule(ft.fiber);
         } else {
 
-            if(m_stop_sign && !m_sleep_sign && this->stopping()) {
+            //fibers pinned to other workers or still running keep the scheduler alive.
+            if(m_stop_sign && !m_sleep_sign && drained && m_active_thread_count == 0
+                    && this->stopping()) {
                 m_is_stopping = true; 
             }
 
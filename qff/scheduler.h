@@ -22,12 +22,13 @@ private:
         typedef std::function<void()> CallBackType;
         Fiber::ptr fiber;
         ::pid_t thread_id = -1;
+        uint64_t ready_time = 0;
 
         void clear();
 
         FiberAndThread() noexcept;
-        FiberAndThread(Fiber::ptr fib, ::pid_t id = -1) noexcept;
-        FiberAndThread(CallBackType cb, ::pid_t id = -1) noexcept;
+        FiberAndThread(Fiber::ptr fib, ::pid_t id = -1, uint64_t ready = 0) noexcept;
+        FiberAndThread(CallBackType cb, ::pid_t id = -1, uint64_t ready = 0) noexcept;
         FiberAndThread(const FiberAndThread& fat) noexcept;
         FiberAndThread& operator=(const FiberAndThread& fat);
     };
@@ -38,6 +39,7 @@ public:
     typedef std::function<void()> CallBackType;
     
     static Scheduler* GetThis();
+    static size_t GetWorkerIndex() noexcept;
 
     Scheduler(size_t thread_count = 1, const std::string& name="", bool use_caller = true);
     virtual ~Scheduler() noexcept;
@@ -45,21 +47,31 @@ public:
     void start();
     void stop() noexcept;
 
-    void schedule(Fiber::ptr fiber, ::pid_t thread_id = -1);
-    void schedule(CallBackType cb, ::pid_t thread_id = -1);
+    //ready_time(us) marks when the fiber became runnable, see on_event_fiber_run().
+    void schedule(Fiber::ptr fiber, ::pid_t thread_id = -1, uint64_t ready_time = 0);
+    void schedule(CallBackType cb, ::pid_t thread_id = -1, uint64_t ready_time = 0);
     void schedule(const std::vector<Fiber::ptr>& fibs);
     void schedule(const std::vector<CallBackType>& cbs);
 
     const std::string& get_name() const { return m_name; }
+    size_t get_worker_count() const noexcept { return m_thread_count + (m_root_fiber ? 1 : 0); }
+    //threads spawned by start(), the caller thread only runs fibers while stopping.
+    size_t get_thread_count() const noexcept { return m_thread_count; }
+    ::pid_t get_thread_id(size_t index) const noexcept { return m_thread_ids[m_thread_ids.size() - m_thread_count + index]; }
 private:
     static Fiber* GetCacheFiber() noexcept;
     void idle_base();
+    ::pid_t get_pinned_thread(const Fiber::ptr& fiber) noexcept;
 protected:
     virtual void init();
     virtual void tickle();
+    //wakes the worker thread_id for work pinned to it, any idle worker by default.
+    virtual void tickle_thread(::pid_t thread_id);
     virtual bool stopping();
     virtual void idle();
-    void run();
+    //called after a fiber scheduled with a ready_time yields.
+    virtual void on_event_fiber_run(uint64_t wait_us, uint64_t run_us) noexcept {}
+    void run(size_t worker_index);
 
     bool has_idle_threads() noexcept;
 private:
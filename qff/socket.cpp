@@ -2,17 +2,164 @@
 #include "fd_manager.h"
 #include "log.h"
 #include "utils.h"
+#include "io_manager.h"
+#include "hook.h"
+#include "clock.h"
 
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <deque>
 
 namespace qff {
     
+//room for the UDP_GRO segment size.
+static const size_t GRO_CONTROL_SIZE = CMSG_SPACE(sizeof(int));
+//what one UDP_SEGMENT send may carry, older kernels allow no more than 64 segments.
+static const size_t GSO_MAX_SEGMENTS = 64;
+static const size_t GSO_MAX_BYTES = 65000;
+//the largest ipv4 datagram payload, UDP_SEGMENT takes the size in 16 bits.
+static const size_t UDP_MAX_PAYLOAD = 65507;
+
+//MSG_ZEROCOPY sends are numbered from 0 per socket, the kernel reports
+//finished ranges of those numbers on the error queue.
+struct Socket::ZeroCopy {
+    struct Pending {
+        //number of the last send that carries the owner's data.
+        uint32_t last_id;
+        std::shared_ptr<const void> owner;
+    };
+
+    size_t threshold;
+    //an epoll holding the socket with no events, it turns readable only on
+    //EPOLLERR, that is while the error queue holds completions.
+    int watch_fd = -1;
+    uint32_t next_id = 0;
+    //every send numbered below this has completed.
+    uint32_t completed = 0;
+    uint64_t copied = 0;
+    std::deque<Pending> pending;
+    //ranges that completed ahead of an earlier one.
+    std::vector<std::pair<uint32_t, uint32_t> > early;
+
+    void complete(uint32_t lo, uint32_t hi) {
+        if(lo != completed) {
+            early.emplace_back(lo, hi);
+            return;
+        }
+        completed = hi + 1;
+        for(size_t i = 0; i < early.size();) {
+            if(early[i].first == completed) {
+                completed = early[i].second + 1;
+                early.erase(early.begin() + i);
+                i = 0;
+            } else {
+                ++i;
+            }
+        }
+        while(!pending.empty() && (int32_t)(pending.front().last_id - completed) < 0)
+            pending.pop_front();
+    }
+};
+
+DatagramBatch::DatagramBatch(size_t capacity, size_t datagram_size)
+    :m_datagram_size(datagram_size)
+    ,m_buffer(capacity * datagram_size)
+    ,m_iovs(capacity)
+    ,m_addrs(capacity)
+    ,m_control(capacity * GRO_CONTROL_SIZE)
+    ,m_msgs(capacity) {
+    m_segments.reserve(capacity);
+    for(size_t i = 0; i < capacity; ++i) {
+        m_iovs[i].iov_base = m_buffer.data() + i * datagram_size;
+        m_iovs[i].iov_len = datagram_size;
+        m_msgs[i].msg_hdr.msg_iov = &m_iovs[i];
+        m_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+Address::ptr DatagramBatch::get_address(size_t index) const {
+    return Address::Create(get_addr(index), get_addr_len(index));
+}
+
+int DatagramBatch::push(const void* data, size_t length, const Address::ptr& to) {
+    if(to)
+        return this->push(data, length, to->get_addr(), to->get_addr_len());
+    return this->push(data, length, nullptr, 0);
+}
+
+int DatagramBatch::push(const void* data, size_t length, const sockaddr* to, socklen_t to_len) {
+    if(m_count == m_msgs.size() || length > m_datagram_size || to_len > sizeof(sockaddr_storage))
+        return -1;
+    msghdr& hdr = m_msgs[m_count].msg_hdr;
+    memcpy(m_iovs[m_count].iov_base, data, length);
+    m_iovs[m_count].iov_len = length;
+    if(to) {
+        memcpy(&m_addrs[m_count], to, to_len);
+        hdr.msg_name = &m_addrs[m_count];
+    } else {
+        hdr.msg_name = nullptr;
+    }
+    hdr.msg_namelen = to_len;
+    hdr.msg_control = nullptr;
+    hdr.msg_controllen = 0;
+    hdr.msg_flags = 0;
+    m_msgs[m_count].msg_len = length;
+    m_segments.push_back({(uint32_t)m_count, 0, (uint32_t)length});
+    ++m_count;
+    return 0;
+}
+
+void DatagramBatch::prepare_recv() noexcept {
+    this->clear();
+    for(size_t i = 0; i < m_msgs.size(); ++i) {
+        msghdr& hdr = m_msgs[i].msg_hdr;
+        m_iovs[i].iov_len = m_datagram_size;
+        hdr.msg_name = &m_addrs[i];
+        hdr.msg_namelen = sizeof(sockaddr_storage);
+        hdr.msg_control = m_control.data() + i * GRO_CONTROL_SIZE;
+        hdr.msg_controllen = GRO_CONTROL_SIZE;
+        hdr.msg_flags = 0;
+        m_msgs[i].msg_len = 0;
+    }
+}
+
+void DatagramBatch::split_received(size_t count) {
+    m_count = count;
+    for(size_t i = 0; i < count; ++i) {
+        msghdr& hdr = m_msgs[i].msg_hdr;
+        uint32_t length = m_msgs[i].msg_len;
+        uint32_t segment = length;
+        for(cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+            if(cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int size;
+                memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                if(size > 0)
+                    segment = size;
+            }
+        }
+        uint32_t offset = 0;
+        do {
+            uint32_t n = std::min(segment, length - offset);
+            m_segments.push_back({(uint32_t)i, offset, n});
+            offset += n;
+        } while(offset < length);
+    }
+}
+
 Socket::Socket(int family, int type, int protocol) 
     :m_sock(-1) 
     ,m_family(family)
     ,m_type(type)
     ,m_protocol(protocol) 
-    ,m_is_connected(false) {
+    ,m_is_connected(false)
+    ,m_pipe{-1, -1}
+    ,m_gso_disabled(false) {
 }
 
 Socket::~Socket() noexcept {
@@ -79,6 +226,22 @@ Socket::ptr Socket::accept() {
     return sock;
 }
 
+Socket::ptr Socket::accept(SockAddr& peer) {
+    Socket::ptr sock = std::make_shared<Socket>(m_family, m_type, m_protocol);
+    socklen_t len = SockAddr::GetCapacity();
+    int newsock = ::accept(m_sock, peer.get_addr(), &len);
+    if(newsock == -1) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "accept(" << m_sock << ") errno="
+            << errno << " errstr=" << ::strerror(errno);
+        return nullptr;
+    }
+    peer.set_addr_len(len);
+    if(sock->create_sock_from_sockfd(newsock)) {
+        return nullptr;
+    }
+    return sock;
+}
+
 int Socket::bind(const Address::ptr addr) {
     if(!is_valid()) {
         this->create_sock();
@@ -96,12 +259,14 @@ int Socket::bind(const Address::ptr addr) {
 
     UnixAddress::ptr uaddr = std::dynamic_pointer_cast<UnixAddress>(addr);
     if(uaddr) {
+        //a stale path left by a dead process is removed, a live listener keeps it.
         Socket::ptr sock = std::make_shared<Socket>(UNIX, TCP);
-        if(sock->connect(uaddr)) {
+        sock->create_sock();
+        if(::connect_f(sock->get_socket(), uaddr->get_addr(), uaddr->get_addr_len()) == 0) {
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "bind " << *uaddr << " is in use";
             return -1;
-        } else {
-            qff::FSUtils::UnLink(uaddr->get_path(), true);
         }
+        qff::FSUtils::UnLink(uaddr->get_path(), true);
     }
 
     if(::bind(m_sock, addr->get_addr(), addr->get_addr_len())) {
@@ -174,6 +339,11 @@ int Socket::listen(int backlog) {
 }
 
 int Socket::close() {
+    this->close_pipe();
+    if(m_zerocopy) {
+        ::close(m_zerocopy->watch_fd);
+        m_zerocopy.reset();
+    }
     if(!m_is_connected && m_sock == -1) 
         return 0;
     m_is_connected = false;
@@ -224,6 +394,14 @@ int Socket::send_to(const iovec* buffers, size_t length, const Address::ptr to,
     return -1;
 }
 
+int Socket::send_to(const void* buffer, size_t length, const SockAddr& to, int flags) {
+    if(!is_valid()) {
+        errno = EBADF;
+        return -1;
+    }
+    return ::sendto(m_sock, buffer, length, flags, to.get_addr(), to.get_addr_len());
+}
+
 int Socket::recv(void* buffer, size_t length, int flags) {
     if(is_connected()) {
         return ::recv(m_sock, buffer, length, flags);
@@ -250,6 +428,18 @@ int Socket::recv_from(void* buffer, size_t length, Address::ptr from, int flags)
     return -1;
 }
 
+int Socket::recv_from(void* buffer, size_t length, SockAddr& from, int flags) {
+    if(!is_valid()) {
+        errno = EBADF;
+        return -1;
+    }
+    socklen_t len = SockAddr::GetCapacity();
+    int rt = ::recvfrom(m_sock, buffer, length, flags, from.get_addr(), &len);
+    if(rt >= 0)
+        from.set_addr_len(len);
+    return rt;
+}
+
 int Socket::recv_from(iovec* buffers, size_t length, Address::ptr from, int flags) {
     if(is_connected()) {
         msghdr msg;
@@ -263,6 +453,421 @@ int Socket::recv_from(iovec* buffers, size_t length, Address::ptr from, int flag
     return -1;
 }
 
+int Socket::recv_batch(DatagramBatch& batch, int flags) {
+    if(!is_valid())
+        return -1;
+    batch.prepare_recv();
+    //MSG_WAITFORONE keeps a blocking socket from waiting for a full batch.
+    int rt = ::recvmmsg(m_sock, batch.m_msgs.data(), batch.m_msgs.size(), flags | MSG_WAITFORONE, nullptr);
+    if(rt <= 0)
+        return rt;
+    batch.split_received(rt);
+    return batch.get_count();
+}
+
+int Socket::send_batch(DatagramBatch& batch, int flags) {
+    if(!is_valid())
+        return -1;
+    size_t sent = 0;
+    while(sent < batch.m_count) {
+        int rt = ::sendmmsg(m_sock, batch.m_msgs.data() + sent, batch.m_count - sent, flags);
+        if(rt <= 0)
+            return sent ? sent : -1;
+        sent += rt;
+    }
+    return sent;
+}
+
+//SCM_MAX_FD in the kernel.
+static const size_t MAX_PASSED_FDS = 253;
+
+int Socket::send_fds(const int* fds, size_t count, const void* data, size_t length) {
+    if(!is_connected() || m_family != UNIX || !length || count > MAX_PASSED_FDS)
+        return -1;
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * count));
+    iovec iov{(void*)data, length};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if(count) {
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+    }
+    return ::sendmsg(m_sock, &msg, MSG_NOSIGNAL);
+}
+
+int Socket::recv_fds(std::vector<int>& fds, void* data, size_t length) {
+    if(!is_connected() || m_family != UNIX)
+        return -1;
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS));
+    iovec iov{data, length};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    int rt = ::recvmsg(m_sock, &msg, MSG_CMSG_CLOEXEC);
+    if(rt < 0)
+        return rt;
+    for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const char* p = (const char*)CMSG_DATA(cmsg);
+        for(size_t i = 0; i < count; ++i) {
+            int fd;
+            memcpy(&fd, p + i * sizeof(int), sizeof(int));
+            fds.push_back(fd);
+        }
+    }
+    if(msg.msg_flags & MSG_CTRUNC)
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "recv_fds sock=" << m_sock << " control data truncated";
+    return rt;
+}
+
+ssize_t Socket::send_segmented(const void* buffer, size_t length, size_t segment_size,
+                               const Address::ptr& to, int flags) {
+    if(!is_valid() || !segment_size)
+        return -1;
+    if(segment_size > UDP_MAX_PAYLOAD) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    const char* data = (const char*)buffer;
+    size_t per_send = std::max<size_t>(std::min(GSO_MAX_SEGMENTS, GSO_MAX_BYTES / segment_size), 1) * segment_size;
+    size_t sent = 0;
+    while(sent < length) {
+        size_t chunk = std::min(per_send, length - sent);
+        ssize_t rt = -1;
+        if(!m_gso_disabled) {
+            rt = this->send_gso(data + sent, chunk, segment_size, to, flags);
+            //EINVAL means a bad segment size for the route, not a kernel without GSO.
+            if(rt == -1 && (errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+                QFF_LOG_INFO(QFF_LOG_SYSTEM) << "sock=" << m_sock << " UDP_SEGMENT refused errno="
+                    << errno << " errstr=" << strerror(errno) << ", falling back to sendmmsg";
+                m_gso_disabled = true;
+            }
+        }
+        if(m_gso_disabled)
+            rt = this->send_segments(data + sent, chunk, segment_size, to, flags);
+        if(rt <= 0)
+            return sent ? sent : -1;
+        sent += rt;
+    }
+    return sent;
+}
+
+int Socket::enable_gro() {
+    int val = 1;
+    return this->set_option(SOL_UDP, UDP_GRO, val);
+}
+
+ssize_t Socket::send_gso(const void* buffer, size_t length, size_t segment_size,
+                         const Address::ptr& to, int flags) {
+    iovec iov{(void*)buffer, length};
+    char control[CMSG_SPACE(sizeof(uint16_t))] = {0};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if(to) {
+        msg.msg_name = (void*)to->get_addr();
+        msg.msg_namelen = to->get_addr_len();
+    }
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t size = segment_size;
+    memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+    return ::sendmsg(m_sock, &msg, flags);
+}
+
+ssize_t Socket::send_segments(const void* buffer, size_t length, size_t segment_size,
+                              const Address::ptr& to, int flags) {
+    //one chunk of send_segmented is never over GSO_MAX_SEGMENTS datagrams.
+    mmsghdr msgs[GSO_MAX_SEGMENTS];
+    iovec iovs[GSO_MAX_SEGMENTS];
+    size_t count = 0;
+    for(size_t offset = 0; offset < length && count < GSO_MAX_SEGMENTS; offset += segment_size, ++count) {
+        iovs[count].iov_base = (char*)buffer + offset;
+        iovs[count].iov_len = std::min(segment_size, length - offset);
+        memset(&msgs[count], 0, sizeof(mmsghdr));
+        msgs[count].msg_hdr.msg_iov = &iovs[count];
+        msgs[count].msg_hdr.msg_iovlen = 1;
+        if(to) {
+            msgs[count].msg_hdr.msg_name = (void*)to->get_addr();
+            msgs[count].msg_hdr.msg_namelen = to->get_addr_len();
+        }
+    }
+    size_t done = 0;
+    ssize_t bytes = 0;
+    while(done < count) {
+        int rt = ::sendmmsg(m_sock, msgs + done, count - done, flags);
+        if(rt <= 0)
+            return bytes ? bytes : -1;
+        for(int i = 0; i < rt; ++i)
+            bytes += iovs[done + i].iov_len;
+        done += rt;
+    }
+    return bytes;
+}
+
+int Socket::enable_zerocopy(size_t threshold) {
+    if(m_zerocopy) {
+        m_zerocopy->threshold = threshold;
+        return 0;
+    }
+    int val = 1;
+    if(!is_valid() || m_type != TCP || this->set_option(SOL_SOCKET, SO_ZEROCOPY, val))
+        return -1;
+    int fd = ::epoll_create1(EPOLL_CLOEXEC);
+    ::epoll_event event;
+    memset(&event, 0, sizeof(event));
+    if(fd == -1 || ::epoll_ctl(fd, EPOLL_CTL_ADD, m_sock, &event)) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "zerocopy watch sock=" << m_sock
+            << " errno=" << errno << " errstr=" << ::strerror(errno);
+        if(fd != -1)
+            ::close(fd);
+        return -1;
+    }
+    m_zerocopy.reset(new ZeroCopy);
+    m_zerocopy->threshold = threshold;
+    m_zerocopy->watch_fd = fd;
+    return 0;
+}
+
+size_t Socket::get_zerocopy_pending() const noexcept {
+    return m_zerocopy ? m_zerocopy->pending.size() : 0;
+}
+
+uint64_t Socket::get_zerocopy_copied() const noexcept {
+    return m_zerocopy ? m_zerocopy->copied : 0;
+}
+
+ssize_t Socket::send_zerocopy(const void* data, size_t length, std::shared_ptr<const void> owner) {
+    if(!is_connected())
+        return -1;
+    const char* p = (const char*)data;
+    size_t sent = 0;
+    ZeroCopy* zc = m_zerocopy.get();
+    if(!zc || length < zc->threshold) {
+        while(sent < length) {
+            ssize_t rt = ::send(m_sock, p + sent, length - sent, MSG_NOSIGNAL);
+            if(rt <= 0)
+                return -1;
+            sent += rt;
+        }
+        return sent;
+    }
+
+    this->reap_zerocopy();
+    uint32_t first_id = zc->next_id;
+    int error = 0;
+    while(sent < length) {
+        ssize_t rt = ::send(m_sock, p + sent, length - sent, MSG_ZEROCOPY | MSG_NOSIGNAL);
+        if(rt == -1) {
+            //the pinned pages are over the socket's optmem limit until something completes.
+            if(errno == ENOBUFS && !zc->pending.empty()
+                    && this->wait_completions(zc->pending.size() - 1, -1) == 0)
+                continue;
+            error = errno;
+            break;
+        }
+        sent += rt;
+        ++zc->next_id;
+    }
+    if(zc->next_id != first_id)
+        zc->pending.push_back({zc->next_id - 1, std::move(owner)});
+    if(error) {
+        errno = error;
+        return -1;
+    }
+    return sent;
+}
+
+int Socket::wait_zerocopy(uint64_t timeout_ms) {
+    return this->wait_completions(0, timeout_ms);
+}
+
+void Socket::reap_zerocopy() {
+    ZeroCopy* zc = m_zerocopy.get();
+    char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+    while(zc && !zc->pending.empty()) {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        //the unhooked call, an empty error queue must not park.
+        if(::recvmsg_f(m_sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+            break;
+        for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if(!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                    && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+            sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if(err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            if(err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                zc->copied += err.ee_data - err.ee_info + 1;
+            zc->complete(err.ee_info, err.ee_data);
+        }
+    }
+}
+
+int Socket::wait_completions(size_t pending, uint64_t timeout_ms) {
+    ZeroCopy* zc = m_zerocopy.get();
+    uint64_t deadline = timeout_ms == (uint64_t)-1 ? -1 : GetMonotonicMS() + timeout_ms;
+    size_t last = -1;
+    while(true) {
+        this->reap_zerocopy();
+        if(!zc || zc->pending.size() <= pending)
+            return 0;
+        //a wakeup that reaped nothing was a socket error, not a completion.
+        if(last == zc->pending.size()) {
+            int error = 0;
+            if(!this->get_option(SOL_SOCKET, SO_ERROR, error) && error) {
+                errno = error;
+                return -1;
+            }
+        }
+        last = zc->pending.size();
+        uint64_t now = GetMonotonicMS();
+        if(now >= deadline) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        uint64_t wait_ms = deadline == (uint64_t)-1 ? -1 : deadline - now;
+
+        IOManager* iom = IOManager::GetThis();
+        if(!iom || !is_hook_enable()) {
+            pollfd pfd = {zc->watch_fd, POLLIN, 0};
+            ::poll_f(&pfd, 1, (int)std::min<uint64_t>(wait_ms, INT_MAX));
+            continue;
+        }
+        TimerHandle timer;
+        if(wait_ms != (uint64_t)-1) {
+            int fd = zc->watch_fd;
+            timer = iom->add_timer_handle(wait_ms, [iom, fd]{ iom->cancel_event(fd, IOManager::READ); });
+        }
+        if(iom->add_event(zc->watch_fd, IOManager::READ)) {
+            if(timer)
+                timer.cancel();
+            return -1;
+        }
+        Fiber::YieldToHold();
+        if(timer)
+            timer.cancel();
+    }
+}
+
+//moves count bytes already in the pipe to out_fd.
+static ssize_t DrainPipe(int pipe_fd, int out_fd, size_t count) {
+    size_t moved = 0;
+    while(moved < count) {
+        ssize_t rt = ::splice(pipe_fd, nullptr, out_fd, nullptr, count - moved, SPLICE_F_MOVE);
+        if(rt <= 0)
+            return -1;
+        moved += rt;
+    }
+    return moved;
+}
+
+ssize_t Socket::send_file(int file_fd, off_t offset, size_t length) {
+    if(!is_connected())
+        return -1;
+
+    size_t sent = 0;
+    while(sent < length) {
+        ssize_t rt = ::sendfile(m_sock, file_fd, &offset, length - sent);
+        if(rt > 0) {
+            sent += rt;
+            continue;
+        }
+        if(rt == 0)
+            break;
+        //the file cannot be mapped, e.g. some fuse or proc files.
+        if(errno == EINVAL || errno == ENOSYS) {
+            rt = this->splice_file(file_fd, offset, length - sent);
+            if(rt < 0)
+                return sent ? sent : -1;
+            return sent + rt;
+        }
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "sendfile sock=" << m_sock << " file=" << file_fd
+            << " errno=" << errno << " errstr=" << ::strerror(errno);
+        return sent ? sent : -1;
+    }
+    return sent;
+}
+
+ssize_t Socket::splice_to(Socket& dst, size_t length) {
+    if(!is_connected() || !dst.is_connected() || this->open_pipe())
+        return -1;
+
+    ssize_t rt = ::splice(m_sock, nullptr, m_pipe[1], nullptr, length, SPLICE_F_MOVE);
+    if(rt <= 0)
+        return rt;
+    if(DrainPipe(m_pipe[0], dst.m_sock, rt) != rt) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "splice_to sock=" << m_sock << " dst=" << dst.m_sock
+            << " errno=" << errno << " errstr=" << ::strerror(errno);
+        //the pipe may still hold bytes that must not reach the next call.
+        this->close_pipe();
+        return -1;
+    }
+    return rt;
+}
+
+ssize_t Socket::splice_file(int file_fd, off_t offset, size_t length) {
+    if(this->open_pipe())
+        return -1;
+
+    loff_t off = offset;
+    size_t sent = 0;
+    while(sent < length) {
+        ssize_t rt = ::splice(file_fd, &off, m_pipe[1], nullptr, length - sent, SPLICE_F_MOVE);
+        if(rt == 0)
+            break;
+        if(rt < 0 || DrainPipe(m_pipe[0], m_sock, rt) != rt) {
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "splice sock=" << m_sock << " file=" << file_fd
+                << " errno=" << errno << " errstr=" << ::strerror(errno);
+            this->close_pipe();
+            return sent ? sent : -1;
+        }
+        sent += rt;
+    }
+    return sent;
+}
+
+int Socket::open_pipe() {
+    if(m_pipe[0] != -1)
+        return 0;
+    if(::pipe2(m_pipe, O_CLOEXEC)) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "pipe2 sock=" << m_sock
+            << " errno=" << errno << " errstr=" << ::strerror(errno);
+        m_pipe[0] = m_pipe[1] = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void Socket::close_pipe() {
+    if(m_pipe[0] == -1)
+        return;
+    ::close(m_pipe[0]);
+    ::close(m_pipe[1]);
+    m_pipe[0] = m_pipe[1] = -1;
+}
+
 Address::ptr Socket::get_remote_address() {
     if(m_remote_address) {
         return m_remote_address;
@@ -329,6 +934,33 @@ Address::ptr Socket::get_local_address() {
     return m_local_address;
 }
 
+int Socket::get_remote_address(SockAddr& result) const {
+    if(m_remote_address) {
+        result = SockAddr(*m_remote_address);
+        return 0;
+    }
+    socklen_t len = SockAddr::GetCapacity();
+    if(getpeername(m_sock, result.get_addr(), &len))
+        return -1;
+    result.set_addr_len(len);
+    return 0;
+}
+
+int Socket::get_local_address(SockAddr& result) const {
+    if(m_local_address) {
+        result = SockAddr(*m_local_address);
+        return 0;
+    }
+    socklen_t len = SockAddr::GetCapacity();
+    if(getsockname(m_sock, result.get_addr(), &len)) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "getsockname error sock=" << m_sock
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        return -1;
+    }
+    result.set_addr_len(len);
+    return 0;
+}
+
 bool Socket::is_valid() const {
     return m_sock != -1;
 }
@@ -383,7 +1015,7 @@ int Socket::cancel_all() {
 void Socket::init_sock_opt() {
     int val = 1;
     set_option(SOL_SOCKET, SO_REUSEADDR, val);
-    if(m_type == SOCK_STREAM)
+    if(m_type == SOCK_STREAM && m_family != UNIX)
         set_option(IPPROTO_TCP, TCP_NODELAY, val);
 }
 
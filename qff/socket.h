@@ -2,14 +2,80 @@
 #define __QFF_SOCKET_H__
 
 #include <memory>
+#include <vector>
 #include <sys/types.h>
 #include <sys/socket.h>
 
 #include "address.h"
+#include "macro.h"
 
 namespace qff {
     
+class TcpServer;
+class Socket;
+
+//datagram slots for Socket::recv_batch and Socket::send_batch. the mmsghdr,
+//iovec, address, control and payload arrays are allocated once and reused.
+//with UDP_GRO on one slot may hold several coalesced datagrams, recv_batch
+//splits them so every index below is one datagram. slots should be 64K then.
+class DatagramBatch final {
+friend Socket;
+public:
+    NONECOPYABLE(DatagramBatch);
+
+    DatagramBatch(size_t capacity, size_t datagram_size = 2048);
+
+    size_t get_capacity() const noexcept { return m_msgs.size();}
+    size_t get_datagram_size() const noexcept { return m_datagram_size;}
+    //datagrams received by the last recv_batch or pushed since the last clear.
+    size_t get_count() const noexcept { return m_segments.size();}
+    void clear() noexcept { m_count = 0; m_segments.clear();}
+
+    const char* get_data(size_t index) const noexcept {
+        const Segment& seg = m_segments[index];
+        return m_buffer.data() + seg.slot * m_datagram_size + seg.offset;
+    }
+    size_t get_length(size_t index) const noexcept { return m_segments[index].length;}
+    //true when the datagram was longer than the slot and got cut.
+    bool is_truncated(size_t index) const noexcept { return get_hdr(index).msg_flags & MSG_TRUNC;}
+    const sockaddr* get_addr(size_t index) const noexcept { return (const sockaddr*)&m_addrs[m_segments[index].slot];}
+    socklen_t get_addr_len(size_t index) const noexcept { return get_hdr(index).msg_namelen;}
+    SockAddr get_sockaddr(size_t index) const noexcept { return SockAddr(get_addr(index), get_addr_len(index));}
+    //allocates, get_addr() and get_sockaddr() do not.
+    Address::ptr get_address(size_t index) const;
+
+    //copies a datagram in for send_batch, to may be null on a connected socket.
+    //returns -1 when the batch is full or length is over the datagram size.
+    int push(const void* data, size_t length, const Address::ptr& to = nullptr);
+    int push(const void* data, size_t length, const sockaddr* to, socklen_t to_len);
+    int push(const void* data, size_t length, const SockAddr& to) {
+        return push(data, length, to.get_addr(), to.get_addr_len());
+    }
+private:
+    struct Segment {
+        uint32_t slot;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    const msghdr& get_hdr(size_t index) const noexcept { return m_msgs[m_segments[index].slot].msg_hdr;}
+    void prepare_recv() noexcept;
+    //splits the received slots by their UDP_GRO segment size.
+    void split_received(size_t count);
+private:
+    size_t m_datagram_size;
+    //slots in use.
+    size_t m_count = 0;
+    std::vector<char> m_buffer;
+    std::vector<iovec> m_iovs;
+    std::vector<sockaddr_storage> m_addrs;
+    std::vector<char> m_control;
+    std::vector<mmsghdr> m_msgs;
+    std::vector<Segment> m_segments;
+};
+
 class Socket {
+friend TcpServer;
 public:
     typedef std::shared_ptr<Socket> ptr;
 
@@ -59,6 +125,60 @@ public:
     virtual int recv_from(void* buffer, size_t length, Address::ptr from, int flags = 0);
     virtual int recv_from(iovec* buffers, size_t length, Address::ptr from, int flags = 0);
 
+    //SockAddr versions for the per-packet and per-accept paths, nothing here
+    //allocates an Address. datagram sockets need not be connected.
+    //peer is filled by accept itself, get_remote_address() would allocate it.
+    virtual Socket::ptr accept(SockAddr& peer);
+    int send_to(const void* buffer, size_t length, const SockAddr& to, int flags = 0);
+    int recv_from(void* buffer, size_t length, SockAddr& from, int flags = 0);
+    int get_remote_address(SockAddr& result) const;
+    int get_local_address(SockAddr& result) const;
+
+    //datagram sockets only, they need not be connected.
+    //fills the batch with one recvmmsg, parking only while nothing is queued.
+    //returns the datagrams received, also kept in batch.get_count().
+    int recv_batch(DatagramBatch& batch, int flags = 0);
+    //sends every pushed datagram with as few sendmmsg calls as the kernel allows.
+    //returns the datagrams sent, fewer than pushed only on an error.
+    int send_batch(DatagramBatch& batch, int flags = 0);
+    //sends length bytes as datagrams of segment_size, the last one may be shorter.
+    //uses UDP_SEGMENT so one sendmsg carries up to 64 datagrams, and falls back
+    //to sendmmsg for good once the kernel refuses it. returns the bytes sent, -1 with
+    //EMSGSIZE for a segment_size above the largest udp payload.
+    ssize_t send_segmented(const void* buffer, size_t length, size_t segment_size,
+                           const Address::ptr& to = nullptr, int flags = 0);
+    //unix sockets only. passes fds with SCM_RIGHTS along with a non empty payload,
+    //the receiver gets its own descriptions of them.
+    int send_fds(const int* fds, size_t count, const void* data, size_t length);
+    //returns the payload bytes received, the passed fds are appended to fds.
+    int recv_fds(std::vector<int>& fds, void* data, size_t length);
+
+    //lets the kernel coalesce received datagrams for recv_batch to split.
+    //returns -1 when the kernel lacks UDP_GRO, recv_batch works the same then.
+    int enable_gro();
+
+    //send_zerocopy uses MSG_ZEROCOPY for sends of at least threshold bytes from now on.
+    //returns -1 when the kernel lacks SO_ZEROCOPY, send_zerocopy copies then.
+    int enable_zerocopy(size_t threshold = 64 * 1024);
+    bool is_zerocopy() const noexcept { return m_zerocopy != nullptr;}
+    //sends all of data. owner keeps the pages alive until the kernel reports it is
+    //done with them on the error queue, small sends copy and let go of it at once.
+    //returns length or -1, data sent before an error stays owned.
+    ssize_t send_zerocopy(const void* data, size_t length, std::shared_ptr<const void> owner);
+    //reaps completions until no zero-copy send is pending, returns 0 or -1 with ETIMEDOUT.
+    //close() drops the owners still pending, call this first to keep the data intact.
+    int wait_zerocopy(uint64_t timeout_ms = -1);
+    size_t get_zerocopy_pending() const noexcept;
+    //sends the kernel reported it copied after all, on loopback that is every send.
+    uint64_t get_zerocopy_copied() const noexcept;
+
+    //sends length bytes of file_fd from offset with sendfile, falling back to splice
+    //through a pipe. returns the bytes sent, short only at the end of the file.
+    virtual ssize_t send_file(int file_fd, off_t offset, size_t length);
+    //moves up to length bytes received on this socket to dst through a pipe,
+    //returns the bytes moved, 0 at eof.
+    virtual ssize_t splice_to(Socket& dst, size_t length);
+
     Address::ptr get_remote_address();
     Address::ptr get_local_address();
 
@@ -81,12 +201,29 @@ protected:
     void init_sock_opt();
     void create_sock();
     virtual int create_sock_from_sockfd(int sock);
+    int open_pipe();
+    void close_pipe();
+    ssize_t splice_file(int file_fd, off_t offset, size_t length);
+    ssize_t send_gso(const void* buffer, size_t length, size_t segment_size,
+                     const Address::ptr& to, int flags);
+    ssize_t send_segments(const void* buffer, size_t length, size_t segment_size,
+                          const Address::ptr& to, int flags);
+    void reap_zerocopy();
+    //parks until at most pending zero-copy sends are left.
+    int wait_completions(size_t pending, uint64_t timeout_ms);
 protected:
+    struct ZeroCopy;
     int m_sock;
     int m_family;
     int m_type;
     int m_protocol;
     bool m_is_connected;
+    //created on the first splice, kept until close().
+    int m_pipe[2];
+    //set once a UDP_SEGMENT send was refused.
+    bool m_gso_disabled;
+    //created by enable_zerocopy().
+    std::unique_ptr<ZeroCopy> m_zerocopy;
     Address::ptr m_local_address;
     Address::ptr m_remote_address;
 };
@@ -0,0 +1,258 @@
+#include "socket_stream.h"
+#include "hook.h"
+#include "log.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace qff {
+
+static const size_t WRITE_NODE_SIZE = 4096;
+//keeps one writev far below IOV_MAX.
+static const size_t MAX_WRITE_CHUNK = 256 * WRITE_NODE_SIZE;
+
+SocketStream::SocketStream(Socket::ptr sock, bool owner, size_t read_ahead, size_t flush_threshold)
+    :m_socket(sock)
+    ,m_owner(owner)
+    ,m_read_ahead(read_ahead)
+    ,m_flush_threshold(flush_threshold)
+    ,m_read_buffer(read_ahead)
+    ,m_write_buffer(WRITE_NODE_SIZE) {
+    m_yield_hook.fun = &SocketStream::OnYield;
+    m_yield_hook.arg = this;
+}
+
+SocketStream::~SocketStream() noexcept {
+    if(m_owner)
+        this->close();
+    else
+        this->flush();
+    Fiber::DelYieldHook(&m_yield_hook);
+}
+
+int SocketStream::read(void* buffer, size_t length) {
+    if(length == 0)
+        return 0;
+    if(!get_buffered()) {
+        int rt = this->fill();
+        if(rt <= 0)
+            return rt;
+    }
+    size_t n = std::min(length, get_buffered());
+    m_read_buffer.read(buffer, n, m_read_pos);
+    this->consume(n);
+    return n;
+}
+
+int SocketStream::read_fixed(void* buffer, size_t length) {
+    while(get_buffered() < length) {
+        int rt = this->fill();
+        if(rt <= 0)
+            return rt;
+    }
+    m_read_buffer.read(buffer, length, m_read_pos);
+    this->consume(length);
+    return length;
+}
+
+int SocketStream::read_until(std::string& out, std::string_view delim, size_t max_length) {
+    while(true) {
+        size_t found = this->find_buffered(delim, m_searched);
+        if(found != std::string::npos) {
+            size_t n = found + delim.size();
+            size_t old_size = out.size();
+            out.resize(old_size + n);
+            m_read_buffer.read(&out[old_size], n, m_read_pos);
+            this->consume(n);
+            return n;
+        }
+
+        //a delimiter may still end in the bytes of the next read.
+        size_t buffered = get_buffered();
+        m_searched = buffered >= delim.size() ? buffered - delim.size() + 1 : 0;
+        if(buffered >= max_length) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        int rt = this->fill();
+        if(rt <= 0)
+            return rt;
+    }
+}
+
+int SocketStream::peek(void* buffer, size_t length) {
+    while(get_buffered() < length) {
+        int rt = this->fill();
+        if(rt < 0)
+            return -1;
+        if(rt == 0)
+            break;
+    }
+    size_t n = std::min(length, get_buffered());
+    m_read_buffer.read(buffer, n, m_read_pos);
+    return n;
+}
+
+int SocketStream::write(const void* buffer, size_t length) {
+    if(!is_connected())
+        return -1;
+
+    //a large write goes out directly when nothing is queued in front of it.
+    if(length >= m_flush_threshold && !get_queued()) {
+        size_t sent = 0;
+        while(sent < length) {
+            int rt = m_socket->send((const char*)buffer + sent, length - sent, MSG_NOSIGNAL);
+            if(rt <= 0) {
+                QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "SocketStream::write sock=" << m_socket->get_socket()
+                    << " errno=" << errno << " errstr=" << ::strerror(errno);
+                return -1;
+            }
+            sent += rt;
+        }
+        return length;
+    }
+
+    m_write_buffer.write(buffer, length);
+    if(get_queued() >= m_flush_threshold)
+        return this->flush() ? -1 : (int)length;
+    Fiber::AddYieldHook(&m_yield_hook);
+    return length;
+}
+
+int SocketStream::flush() {
+    Fiber::DelYieldHook(&m_yield_hook);
+    while(get_queued()) {
+        if(!is_connected()) {
+            m_write_buffer.reset();
+            m_write_pos = 0;
+            return -1;
+        }
+        m_write_iovs.clear();
+        m_write_buffer.get_read_buffers(m_write_iovs, std::min(get_queued(), MAX_WRITE_CHUNK), m_write_pos);
+        int rt = m_socket->send(m_write_iovs.data(), m_write_iovs.size(), MSG_NOSIGNAL);
+        if(rt <= 0) {
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "SocketStream::flush sock=" << m_socket->get_socket()
+                << " errno=" << errno << " errstr=" << ::strerror(errno);
+            return -1;
+        }
+        this->on_written(rt);
+    }
+    return 0;
+}
+
+int SocketStream::close() {
+    int rt = this->flush();
+    if(m_socket && m_socket->close())
+        rt = -1;
+    return rt;
+}
+
+int SocketStream::fill() {
+    //the peer may be waiting for what we queued before it answers.
+    if(get_queued() && this->flush())
+        return -1;
+    this->compact();
+
+    m_read_iovs.clear();
+    m_read_buffer.get_write_buffers(m_read_iovs, m_read_ahead);
+    int rt = m_socket->recv(m_read_iovs.data(), m_read_iovs.size());
+    if(rt > 0)
+        m_read_buffer.set_position(m_read_buffer.get_position() + rt);
+    return rt;
+}
+
+void SocketStream::compact() {
+    if(m_read_pos < m_read_ahead)
+        return;
+    size_t buffered = get_buffered();
+    std::string rest(buffered, '\0');
+    m_read_buffer.read(&rest[0], buffered, m_read_pos);
+    m_read_buffer.reset();
+    m_read_buffer.write(rest.data(), buffered);
+    m_read_pos = 0;
+}
+
+void SocketStream::consume(size_t length) noexcept {
+    m_read_pos += length;
+    m_searched = 0;
+    if(m_read_pos == m_read_buffer.get_size()) {
+        m_read_buffer.reset();
+        m_read_pos = 0;
+    }
+}
+
+size_t SocketStream::find_buffered(std::string_view delim, size_t from) {
+    size_t buffered = get_buffered();
+    if(delim.empty() || buffered < delim.size())
+        return std::string::npos;
+
+    m_read_iovs.clear();
+    m_read_buffer.get_read_buffers(m_read_iovs, buffered, m_read_pos);
+    auto match = [this, delim](size_t index, size_t offset) {
+        for(char c : delim) {
+            while(offset == m_read_iovs[index].iov_len) {
+                ++index;
+                offset = 0;
+            }
+            if(((const char*)m_read_iovs[index].iov_base)[offset++] != c)
+                return false;
+        }
+        return true;
+    };
+
+    size_t base = 0;
+    for(size_t i = 0; i < m_read_iovs.size(); ++i) {
+        const char* data = (const char*)m_read_iovs[i].iov_base;
+        size_t length = m_read_iovs[i].iov_len;
+        size_t begin = from > base ? from - base : 0;
+        while(begin < length) {
+            const char* hit = (const char*)::memchr(data + begin, delim[0], length - begin);
+            if(!hit)
+                break;
+            size_t offset = hit - data;
+            if(base + offset + delim.size() > buffered)
+                return std::string::npos;
+            if(match(i, offset))
+                return base + offset;
+            begin = offset + 1;
+        }
+        base += length;
+    }
+    return std::string::npos;
+}
+
+void SocketStream::try_flush() noexcept {
+    while(get_queued() && is_connected()) {
+        m_write_iovs.clear();
+        m_write_buffer.get_read_buffers(m_write_iovs, std::min(get_queued(), MAX_WRITE_CHUNK), m_write_pos);
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = m_write_iovs.data();
+        msg.msg_iovlen = m_write_iovs.size();
+        //the fiber is about to give up its thread, so this must not park.
+        ssize_t rt = ::sendmsg_f(m_socket->get_socket(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(rt <= 0) {
+            //errors show up at the next flush(), a full buffer is retried at the next yield.
+            if(rt < 0 && errno == EAGAIN)
+                Fiber::AddYieldHook(&m_yield_hook);
+            return;
+        }
+        this->on_written(rt);
+    }
+}
+
+void SocketStream::on_written(size_t length) noexcept {
+    m_write_pos += length;
+    if(m_write_pos == m_write_buffer.get_size()) {
+        m_write_buffer.reset();
+        m_write_pos = 0;
+    }
+}
+
+void SocketStream::OnYield(void* arg) {
+    int error = errno;
+    ((SocketStream*)arg)->try_flush();
+    errno = error;
+}
+
+} // namespace qff
@@ -0,0 +1,86 @@
+#ifndef __QFF_SOCKET_STREAM_H__
+#define __QFF_SOCKET_STREAM_H__
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "socket.h"
+#include "byte_array.h"
+#include "fiber.h"
+
+namespace qff {
+
+//buffered stream over a connected tcp socket, owned by one fiber at a time.
+//reads go through a read-ahead buffer filled with one readv. small writes are
+//queued and sent with one writev when the threshold is hit, before the stream
+//reads from the socket, or when the writing fiber yields.
+class SocketStream final {
+public:
+    NONECOPYABLE(SocketStream);
+    typedef std::shared_ptr<SocketStream> ptr;
+
+    SocketStream(Socket::ptr sock, bool owner = true,
+                 size_t read_ahead = 64 * 1024, size_t flush_threshold = 64 * 1024);
+    //flushes what is still queued, which may park the fiber.
+    ~SocketStream() noexcept;
+
+    Socket::ptr get_socket() const noexcept { return m_socket;}
+    bool is_connected() const { return m_socket && m_socket->is_connected();}
+    size_t get_buffered() const noexcept { return m_read_buffer.get_size() - m_read_pos;}
+    size_t get_queued() const noexcept { return m_write_buffer.get_size() - m_write_pos;}
+
+    //the read calls return 0 at eof and -1 on error.
+    //up to length bytes, waits only if nothing is buffered.
+    int read(void* buffer, size_t length);
+    //exactly length bytes, at eof the partial data stays buffered.
+    int read_fixed(void* buffer, size_t length);
+    //appends everything up to and including delim, which must not be empty, to out.
+    //returns the appended size.
+    //fails with EMSGSIZE when max_length bytes arrive without delim.
+    int read_until(std::string& out, std::string_view delim, size_t max_length = 64 * 1024);
+    //copies up to length bytes without consuming them, waits until length bytes
+    //are buffered or the peer closed.
+    int peek(void* buffer, size_t length);
+
+    //returns length or -1, the bytes may still be queued.
+    int write(const void* buffer, size_t length);
+    int write(std::string_view data) { return this->write(data.data(), data.size());}
+    //sends everything queued, returns 0 or -1.
+    int flush();
+
+    int close();
+private:
+    //reads once more into the buffer, returns the bytes read.
+    int fill();
+    //moves the unread bytes to the front once they are far enough in.
+    void compact();
+    void consume(size_t length) noexcept;
+    size_t find_buffered(std::string_view delim, size_t from);
+    void try_flush() noexcept;
+    void on_written(size_t length) noexcept;
+
+    static void OnYield(void* arg);
+private:
+    Socket::ptr m_socket;
+    bool m_owner;
+    size_t m_read_ahead;
+    size_t m_flush_threshold;
+
+    ByteArray m_read_buffer;
+    size_t m_read_pos = 0;
+    //how far read_until already looked for the delimiter.
+    size_t m_searched = 0;
+
+    ByteArray m_write_buffer;
+    size_t m_write_pos = 0;
+    Fiber::YieldHook m_yield_hook;
+
+    std::vector<iovec> m_read_iovs;
+    std::vector<iovec> m_write_iovs;
+};
+
+} // namespace qff
+
+#endif
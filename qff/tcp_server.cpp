@@ -0,0 +1,405 @@
+#include "tcp_server.h"
+#include "fd_manager.h"
+#include "hook.h"
+#include "clock.h"
+#include "log.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+namespace qff {
+
+static const char HANDOFF_ACK = 'k';
+static const int HANDOFF_TIMEOUT_MS = 5000;
+
+TcpServer::TcpServer(IOManager* iom, const std::string& name)
+    :m_iom(iom)
+    ,m_name(name) {
+}
+
+TcpServer::~TcpServer() noexcept {
+    this->stop();
+    for(auto i : m_acceptors)
+        delete i;
+}
+
+int TcpServer::bind(Address::ptr addr, int backlog) {
+    if(!m_is_stop || !m_acceptors.empty()) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " is already bound";
+        return -1;
+    }
+
+    //the caller thread of the IOManager only runs fibers while it stops.
+    size_t count = std::max<size_t>(m_iom->get_thread_count(), 1);
+    for(size_t i = 0; i < count; ++i) {
+        Socket::ptr sock = this->open_listener(addr, backlog);
+        if(!sock) {
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " bind " << *addr
+                << " listener " << i << " failed";
+            for(auto j : m_acceptors)
+                delete j;
+            m_acceptors.clear();
+            return -1;
+        }
+        this->add_acceptor(sock);
+        //the others join the port the first one was given.
+        addr = sock->get_local_address();
+    }
+    QFF_LOG_INFO(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " bound " << *addr
+        << " with " << count << " listeners";
+    return 0;
+}
+
+int TcpServer::start() {
+    if(m_acceptors.empty() || !m_is_stop)
+        return -1;
+    m_is_stop = false;
+    auto self = shared_from_this();
+    for(auto i : m_acceptors)
+        m_iom->schedule([self, i]{ self->accept_loop(i); }, i->thread_id);
+    return 0;
+}
+
+void TcpServer::stop() {
+    if(m_is_stop.exchange(true))
+        return;
+    //wakes every acceptor, each one closes its own listener.
+    for(auto i : m_acceptors)
+        m_iom->cancel_all(i->sock->get_socket());
+    MutexType::Lock lock(m_mutex);
+    if(m_handoff)
+        m_iom->cancel_all(m_handoff->get_socket());
+}
+
+int TcpServer::listen_handoff(UnixAddress::ptr path, CallBackType on_drained, uint64_t drain_timeout_ms) {
+    Socket::ptr listener = m_is_stop ? nullptr : this->open_handoff(path);
+    if(!listener) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " listen_handoff " << *path << " failed";
+        return -1;
+    }
+    {
+        MutexType::Lock lock(m_mutex);
+        m_handoff = listener;
+    }
+    auto self = shared_from_this();
+    m_iom->schedule([self, path, on_drained, drain_timeout_ms]{
+        self->handoff_loop(path, on_drained, drain_timeout_ms);
+    });
+    return 0;
+}
+
+int TcpServer::take_over(UnixAddress::ptr path, uint64_t timeout_ms) {
+    if(!m_is_stop || !m_acceptors.empty()) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " is already bound";
+        return -1;
+    }
+    Socket::ptr sock = std::make_shared<Socket>(AF_UNIX, Socket::TCP);
+    if(sock->connect(path, timeout_ms))
+        return -1;
+    sock->set_recv_timeout(timeout_ms);
+
+    std::vector<int> fds;
+    uint32_t count = 0;
+    int rt = sock->recv_fds(fds, &count, sizeof(count));
+    if(rt != sizeof(count) || fds.empty() || fds.size() != count) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " take_over " << *path
+            << " got " << fds.size() << " of " << count << " listeners, rt=" << rt;
+        for(int fd : fds)
+            ::close_f(fd);
+        return -1;
+    }
+    for(size_t i = 0; i < fds.size(); ++i) {
+        int family = AF_INET;
+        socklen_t len = sizeof(family);
+        ::getsockopt(fds[i], SOL_SOCKET, SO_DOMAIN, &family, &len);
+        FdMgr::Get()->add_or_get_fdctx(fds[i], true);
+        Socket::ptr listener = std::make_shared<Socket>(family, Socket::TCP);
+        if(listener->create_sock_from_sockfd(fds[i])) {
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " take_over fd=" << fds[i] << " is not a socket";
+            FdMgr::Get()->del_fdctx(fds[i]);
+            ::close_f(fds[i]);
+            continue;
+        }
+        this->add_acceptor(listener);
+    }
+    if(m_acceptors.empty())
+        return -1;
+
+    //the old process may have run fewer workers, the extra ones join the port.
+    Address::ptr addr = m_acceptors[0]->sock->get_local_address();
+    while(m_acceptors.size() < m_iom->get_thread_count()) {
+        Socket::ptr listener = this->open_listener(addr, SOMAXCONN);
+        if(!listener)
+            break;
+        this->add_acceptor(listener);
+    }
+
+    //the old process stops accepting once it reads the ack.
+    char ack = HANDOFF_ACK;
+    if(sock->send(&ack, 1) != 1) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " take_over " << *path
+            << " ack failed errno=" << errno << " errstr=" << ::strerror(errno);
+    }
+    QFF_LOG_INFO(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " took over " << *addr
+        << " with " << fds.size() << " listeners, running " << m_acceptors.size();
+    return 0;
+}
+
+Address::ptr TcpServer::get_local_address() const {
+    if(m_acceptors.empty())
+        return nullptr;
+    return m_acceptors[0]->sock->get_local_address();
+}
+
+TcpServer::Metrics TcpServer::get_metrics() {
+    Metrics rt;
+    for(auto i : m_acceptors) {
+        rt.accepted += i->accepted.load(std::memory_order_relaxed);
+        rt.rejected += i->rejected.load(std::memory_order_relaxed);
+        rt.errors += i->errors.load(std::memory_order_relaxed);
+        rt.wakeups += i->wakeups.load(std::memory_order_relaxed);
+    }
+    rt.connections = get_connections();
+
+    uint64_t now = GetMonotonicUS();
+    MutexType::Lock lock(m_mutex);
+    if(m_sample_us && now > m_sample_us)
+        rt.accept_rate = (rt.accepted - m_sample_accepted) * 1000000.0 / (now - m_sample_us);
+    m_sample_us = now;
+    m_sample_accepted = rt.accepted;
+    return rt;
+}
+
+void TcpServer::handle_client(Socket::ptr client) {
+    QFF_LOG_INFO(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " handle_client " << client->to_string();
+}
+
+Socket::ptr TcpServer::open_listener(Address::ptr addr, int backlog) {
+    Socket::ptr sock = std::make_shared<Socket>(addr->get_family(), Socket::TCP);
+    sock->create_sock();
+    int val = 1;
+    int fd = sock->get_socket();
+    if(fd == -1
+            || sock->set_option(SOL_SOCKET, SO_REUSEPORT, val)
+            || ::fcntl_f(fd, F_SETFL, ::fcntl_f(fd, F_GETFL, 0) | O_NONBLOCK) == -1
+            || sock->bind(addr)
+            || !sock->listen(backlog))
+        return nullptr;
+    return sock;
+}
+
+Socket::ptr TcpServer::open_handoff(UnixAddress::ptr path) {
+    Socket::ptr sock = std::make_shared<Socket>(AF_UNIX, Socket::TCP);
+    if(sock->bind(path))
+        return nullptr;
+    //an abstract path has no file, the peer check in handoff_loop() still applies.
+    std::string file = path->get_path();
+    bool abstract = file.compare(0, 2, "\\0") == 0;
+    if(!abstract && ::chmod(file.c_str(), 0600)) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " chmod(" << file
+            << ") errno=" << errno << " errstr=" << ::strerror(errno);
+        return nullptr;
+    }
+    if(!sock->listen(1))
+        return nullptr;
+    int fd = sock->get_socket();
+    if(::fcntl_f(fd, F_SETFL, ::fcntl_f(fd, F_GETFL, 0) | O_NONBLOCK) == -1)
+        return nullptr;
+    return sock;
+}
+
+void TcpServer::add_acceptor(Socket::ptr sock) {
+    Acceptor* acceptor = new Acceptor;
+    size_t threads = m_iom->get_thread_count();
+    acceptor->thread_id = threads ? m_iom->get_thread_id(m_acceptors.size() % threads) : -1;
+    acceptor->sock = sock;
+    m_acceptors.push_back(acceptor);
+}
+
+void TcpServer::accept_loop(Acceptor* acceptor) {
+    set_hook_enable(true);
+    int listen_fd = acceptor->sock->get_socket();
+    int family = acceptor->sock->get_family();
+    while(!m_is_stop) {
+        //drain the whole queue before going back to epoll.
+        int error = 0;
+        bool accepted = false;
+        while(!m_is_stop) {
+            int fd = ::accept4_f(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd == -1) {
+                if(errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                error = errno;
+                break;
+            }
+            accepted = true;
+
+            if(m_connections.load(std::memory_order_relaxed) >= m_max_connections) {
+                acceptor->rejected.fetch_add(1, std::memory_order_relaxed);
+                ::close_f(fd);
+                continue;
+            }
+            FdMgr::Get()->add_or_get_fdctx(fd, true);
+            Socket::ptr client = std::make_shared<Socket>(family, Socket::TCP);
+            if(client->create_sock_from_sockfd(fd)) {
+                acceptor->errors.fetch_add(1, std::memory_order_relaxed);
+                FdMgr::Get()->del_fdctx(fd);
+                ::close_f(fd);
+                continue;
+            }
+            acceptor->accepted.fetch_add(1, std::memory_order_relaxed);
+            m_connections.fetch_add(1, std::memory_order_relaxed);
+            auto self = shared_from_this();
+            m_iom->schedule([self, client]{ self->serve(client); }, acceptor->thread_id);
+        }
+        if(accepted)
+            acceptor->wakeups.fetch_add(1, std::memory_order_relaxed);
+        if(m_is_stop)
+            break;
+
+        if(error != EAGAIN) {
+            //EMFILE and friends leave the connection queued, back off instead of spinning.
+            acceptor->errors.fetch_add(1, std::memory_order_relaxed);
+            QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " accept4("
+                << listen_fd << ") errno=" << error << " errstr=" << ::strerror(error);
+            ::usleep(10000);
+            continue;
+        }
+        if(m_iom->add_event(listen_fd, IOManager::READ))
+            break;
+        //stop() may have run its cancel_all before the event was added.
+        if(m_is_stop) {
+            m_iom->del_event(listen_fd, IOManager::READ);
+            break;
+        }
+        Fiber::YieldToHold();
+    }
+    acceptor->sock->close();
+}
+
+void TcpServer::serve(Socket::ptr client) {
+    set_hook_enable(true);
+    this->handle_client(client);
+    if(m_connections.fetch_sub(1, std::memory_order_relaxed) != 1)
+        return;
+    std::vector<Fiber::ptr> fibers;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(get_connections())
+            return;
+        FiberWaiter::WakeAll(m_drain_waiters, fibers);
+    }
+    for(auto& i : fibers)
+        m_iom->schedule(i);
+}
+
+//only a process of our own user may take the listeners.
+static bool IsTrustedPeer(int fd) {
+    ::ucred cred;
+    socklen_t len = sizeof(cred);
+    if(::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "getsockopt(" << fd << ", SO_PEERCRED) errno="
+            << errno << " errstr=" << ::strerror(errno);
+        return false;
+    }
+    if(cred.uid == ::geteuid())
+        return true;
+    QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "handoff peer pid=" << cred.pid << " uid=" << cred.uid
+        << " refused, not uid " << ::geteuid();
+    return false;
+}
+
+void TcpServer::handoff_loop(UnixAddress::ptr path, CallBackType on_drained, uint64_t drain_timeout_ms) {
+    set_hook_enable(true);
+    while(!m_is_stop) {
+        Socket::ptr listener;
+        {
+            MutexType::Lock lock(m_mutex);
+            listener = m_handoff;
+        }
+        if(!listener)
+            break;
+        int listen_fd = listener->get_socket();
+        int fd = ::accept4_f(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd == -1) {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if(errno != EAGAIN || m_iom->add_event(listen_fd, IOManager::READ))
+                break;
+            //woken by a connection or by the cancel_all in stop().
+            if(m_is_stop) {
+                m_iom->del_event(listen_fd, IOManager::READ);
+                break;
+            }
+            Fiber::YieldToHold();
+            continue;
+        }
+        if(!IsTrustedPeer(fd)) {
+            ::close_f(fd);
+            continue;
+        }
+        FdMgr::Get()->add_or_get_fdctx(fd, true);
+        Socket::ptr client = std::make_shared<Socket>(AF_UNIX, Socket::TCP);
+        if(client->create_sock_from_sockfd(fd)) {
+            FdMgr::Get()->del_fdctx(fd);
+            ::close_f(fd);
+            continue;
+        }
+        //one handoff at a time, and the new process can listen on path for the next one.
+        listener->close();
+
+        if(this->hand_off(client) == 0) {
+            {
+                MutexType::Lock lock(m_mutex);
+                m_handoff = nullptr;
+            }
+            QFF_LOG_INFO(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " handed its listeners off, draining "
+                << get_connections() << " connections";
+            this->stop();
+            this->drain(drain_timeout_ms);
+            if(on_drained)
+                on_drained();
+            return;
+        }
+        QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "TcpServer " << m_name << " handoff to " << client->to_string() << " failed";
+        listener = this->open_handoff(path);
+        MutexType::Lock lock(m_mutex);
+        m_handoff = listener;
+    }
+    Socket::ptr listener;
+    {
+        MutexType::Lock lock(m_mutex);
+        listener.swap(m_handoff);
+    }
+    if(listener)
+        listener->close();
+}
+
+int TcpServer::hand_off(Socket::ptr client) {
+    std::vector<int> fds;
+    for(auto i : m_acceptors)
+        fds.push_back(i->sock->get_socket());
+    uint32_t count = fds.size();
+    client->set_recv_timeout(HANDOFF_TIMEOUT_MS);
+    if(client->send_fds(fds.data(), fds.size(), &count, sizeof(count)) != sizeof(count))
+        return -1;
+    //until the ack both processes accept, which is harmless.
+    char ack = 0;
+    if(client->recv(&ack, 1) != 1 || ack != HANDOFF_ACK)
+        return -1;
+    return 0;
+}
+
+void TcpServer::drain(uint64_t timeout_ms) {
+    FiberWaiter waiter;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(!get_connections())
+            return;
+        waiter.park(m_drain_waiters, m_mutex);
+    }
+    waiter.wait(m_iom, timeout_ms);
+}
+
+} // namespace qff
@@ -0,0 +1,104 @@
+#ifndef __QFF_TCP_SERVER_H__
+#define __QFF_TCP_SERVER_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <list>
+#include <atomic>
+#include <functional>
+
+#include "socket.h"
+#include "io_manager.h"
+#include "thread.h"
+#include "fiber_waiter.h"
+
+namespace qff {
+
+//one SO_REUSEPORT listener and acceptor fiber per worker thread of the IOManager,
+//so the kernel spreads connections and each one is served on the worker that accepted it.
+class TcpServer : public std::enable_shared_from_this<TcpServer> {
+public:
+    NONECOPYABLE(TcpServer);
+    typedef std::shared_ptr<TcpServer> ptr;
+    typedef SpinLock MutexType;
+    typedef std::function<void()> CallBackType;
+
+    struct Metrics {
+        uint64_t accepted = 0;
+        //closed right away because max connections was reached.
+        uint64_t rejected = 0;
+        //accept4 failures other than EAGAIN.
+        uint64_t errors = 0;
+        //times an acceptor woke up and drained its queue.
+        uint64_t wakeups = 0;
+        uint64_t connections = 0;
+        //accepted per second since the previous get_metrics().
+        double accept_rate = 0;
+    };
+
+    TcpServer(IOManager* iom, const std::string& name = "qff");
+    virtual ~TcpServer() noexcept;
+
+    //call before start(), port 0 picks one port shared by all the listeners.
+    int bind(Address::ptr addr, int backlog = SOMAXCONN);
+    int start();
+    void stop();
+
+    //hot restart. the running process calls listen_handoff() after start(), a new
+    //process calls take_over() in place of bind() and receives the listeners over
+    //path. the old one then stops accepting, waits for its connections to finish
+    //and runs on_drained, the accept backlog is never closed.
+    int listen_handoff(UnixAddress::ptr path, CallBackType on_drained, uint64_t drain_timeout_ms = -1);
+    int take_over(UnixAddress::ptr path, uint64_t timeout_ms = 3000);
+
+    void set_max_connections(size_t count) noexcept { m_max_connections = count;}
+    size_t get_max_connections() const noexcept { return m_max_connections;}
+    size_t get_connections() const noexcept { return m_connections.load(std::memory_order_relaxed);}
+    Metrics get_metrics();
+
+    const std::string& get_name() const noexcept { return m_name;}
+    Address::ptr get_local_address() const;
+    bool is_stop() const noexcept { return m_is_stop;}
+protected:
+    //runs in its own fiber with hooks enabled, the client is closed when the last reference goes.
+    virtual void handle_client(Socket::ptr client);
+private:
+    struct Acceptor {
+        Socket::ptr sock;
+        ::pid_t thread_id = -1;
+        std::atomic<uint64_t> accepted = {0};
+        std::atomic<uint64_t> rejected = {0};
+        std::atomic<uint64_t> errors = {0};
+        std::atomic<uint64_t> wakeups = {0};
+    };
+
+    Socket::ptr open_listener(Address::ptr addr, int backlog);
+    Socket::ptr open_handoff(UnixAddress::ptr path);
+    void add_acceptor(Socket::ptr sock);
+    void accept_loop(Acceptor* acceptor);
+    void serve(Socket::ptr client);
+    void handoff_loop(UnixAddress::ptr path, CallBackType on_drained, uint64_t drain_timeout_ms);
+    int hand_off(Socket::ptr client);
+    //parks until the last connection is served or timeout_ms passed.
+    void drain(uint64_t timeout_ms);
+private:
+    IOManager* m_iom;
+    std::string m_name;
+    std::vector<Acceptor*> m_acceptors;
+    size_t m_max_connections = -1;
+    std::atomic<size_t> m_connections = {0};
+    std::atomic<bool> m_is_stop = {true};
+    //the unix listener a new process takes the listeners over from.
+    Socket::ptr m_handoff;
+
+    MutexType m_mutex;
+    //woken by serve() when the connections drop to 0.
+    FiberWaiter::List m_drain_waiters;
+    uint64_t m_sample_us = 0;
+    uint64_t m_sample_accepted = 0;
+};
+
+} // namespace qff
+
+#endif
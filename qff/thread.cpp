@@ -45,16 +45,10 @@ Conditon::~Conditon() noexcept {
 }
 
 void Conditon::lock() noexcept {
-    if(m_is_locked) 
-        return;
-    m_is_locked = true;
     ::pthread_mutex_lock(&m_mutex);
 }
 
 void Conditon::unlock() noexcept {
-    if(!m_is_locked)
-        return;
-    m_is_locked = false;
     ::pthread_mutex_unlock(&m_mutex);
 }
 
@@ -77,23 +71,14 @@ RWMutex::~RWMutex() noexcept {
 }
 
 void RWMutex::rdlock() noexcept {
-    if(m_is_locked)
-        return;
-    m_is_locked = true;
     ::pthread_rwlock_rdlock(&m_lock);
 }
 
 void RWMutex::wrlock() noexcept {
-    if(m_is_locked)
-        return;
-    m_is_locked = true;
     ::pthread_rwlock_wrlock(&m_lock);
 }
 
 void RWMutex::unlock() noexcept {
-    if(!m_is_locked)
-        return;
-    m_is_locked = false;
     ::pthread_rwlock_unlock(&m_lock);
 }
 
@@ -108,16 +93,10 @@ Mutex::~Mutex() noexcept {
 }
 
 void Mutex::lock() noexcept {
-    if(m_is_locked)
-        return;
-    m_is_locked = true;
     ::pthread_mutex_lock(&m_mutex);
 }
 
 void Mutex::unlock() noexcept {
-    if(!m_is_locked)
-        return;
-    m_is_locked = false;
     ::pthread_mutex_unlock(&m_mutex);
 }
 
@@ -132,16 +111,10 @@ SpinLock::~SpinLock() noexcept {
 }
 
 void SpinLock::lock() noexcept {
-    if(m_is_locked)
-        return;
-    m_is_locked = true;
     ::pthread_spin_lock(&m_mutex);
 }
 
 void SpinLock::unlock() noexcept {
-    if(!m_is_locked)
-        return;
-    m_is_locked = false;
     ::pthread_spin_unlock(&m_mutex);
 }
 
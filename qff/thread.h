@@ -22,6 +22,8 @@ private:
     sem_t m_semaphore;
 };
 
+//the guards track whether their scope holds the lock, the mutexes keep no
+//such state since any thread may be the one calling them.
 template<class T>
 class ScopeLockImpl final {
 public:
@@ -31,22 +33,29 @@ public:
         :m_mutex(mutex) {
         if(!is_lock) 
             return;
-        m_mutex.lock();
+        this->lock();
     }
 
     ~ScopeLockImpl() noexcept {
-        m_mutex.unlock();
+        this->unlock();
     }
 
     void lock() noexcept {
+        if(m_locked)
+            return;
         m_mutex.lock();
+        m_locked = true;
     }
 
     void unlock() noexcept {
+        if(!m_locked)
+            return;
+        m_locked = false;
         m_mutex.unlock();
     }
 private:
     T& m_mutex;
+    bool m_locked = false;
 };
 
 template<class T>
@@ -58,22 +67,29 @@ public:
         :m_mutex(mutex) {
         if(!is_lock) 
             return;
-        m_mutex.rdlock();
+        this->lock();
     }
 
     ~ScopeReadLockImpl() noexcept {
-        m_mutex.unlock();
+        this->unlock();
     }
 
     void lock() noexcept {
+        if(m_locked)
+            return;
         m_mutex.rdlock();
+        m_locked = true;
     }
 
     void unlock() noexcept {
+        if(!m_locked)
+            return;
+        m_locked = false;
         m_mutex.unlock();
     }
 private:
     T& m_mutex;
+    bool m_locked = false;
 };
 
 template<class T>
@@ -85,22 +101,29 @@ public:
         :m_mutex(mutex) {
         if(!is_lock) 
             return;
-        m_mutex.wrlock();
+        this->lock();
     }
 
     ~ScopeWriteLockImpl() noexcept {
-        m_mutex.unlock();
+        this->unlock();
     }
 
     void lock() noexcept {
+        if(m_locked)
+            return;
         m_mutex.wrlock();
+        m_locked = true;
     }
 
     void unlock() noexcept {
+        if(!m_locked)
+            return;
+        m_locked = false;
         m_mutex.unlock();
     }
 private:
     T& m_mutex;
+    bool m_locked = false;
 };
 
 class Conditon final {
@@ -116,7 +139,6 @@ public:
     void wait() noexcept;
     void notify() noexcept;
 private:
-    bool m_is_locked = false;
     pthread_mutex_t m_mutex;
     pthread_cond_t m_conditon;
 };
@@ -133,7 +155,6 @@ public:
     void wrlock() noexcept;
     void unlock() noexcept;
 private:
-    bool m_is_locked = false;
     pthread_rwlock_t m_lock;
 };
 
@@ -149,7 +170,6 @@ public:
     void lock() noexcept;
     void unlock() noexcept;
 private:
-    bool m_is_locked = false;
     pthread_mutex_t m_mutex;
 };
 
@@ -165,7 +185,6 @@ public:
     void lock() noexcept;
     void unlock() noexcept;
 private:
-    bool m_is_locked = false;
     pthread_spinlock_t m_mutex;
 };
 
@@ -1,118 +1,490 @@
 #include "timer.h"
 
-#include <climits>
-#include "utils.h"
+#include <string.h>
+#include <algorithm>
+#include "clock.h"
 #include "log.h"
 
 namespace qff {
-    
 
-bool Timer::Comparator::operator()(const Timer::ptr lhs
-                                , const Timer::ptr rhs) const noexcept {
-    if(!lhs)
-        return true;
-    if(!rhs)
-        return false;
-    if(lhs->m_next_time < rhs->m_next_time)
-        return true;
-    else 
-        return false;
+//the cached time may be a whole loop old, too coarse for sub-ms intervals.
+static uint64_t GetStartUS(uint64_t us) noexcept {
+    return us < 1000 ? GetMonotonicUS() : GetCachedUS();
 }
 
-Timer::Timer(int ms, CallBackType cb, bool recurring, TimerManager* manager) 
-    :m_recurring(recurring)
-    ,m_ms(ms)
-    ,m_cb(cb)
-    ,m_manager(manager) {
-    m_next_time = GetCurrentMS() + ms;
+Timer::Timer(uint64_t us, CallBackType cb, bool recurring, TimerManager* manager)
+    :m_manager(manager) {
+    this->init(us, std::move(cb), recurring);
 }
 
-Timer::Timer(int next_time) 
-    :m_next_time(next_time) {
-
+void Timer::init(uint64_t us, CallBackType&& cb, bool recurring) noexcept {
+    m_recurring = recurring;
+    m_us = us;
+    m_next_time = GetStartUS(us) + us;
+    m_expire = m_next_time;
+    m_slack.store(DEFAULT_SLACK, std::memory_order_relaxed);
+    m_cb = std::move(cb);
 }
 
 int Timer::cancel() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(!m_manager || !m_cb)
-        return -1;
-
-    auto &timers = m_manager->m_timers;
+    return this->cancel(this->get_generation());
+}
 
-    auto it = timers.find(shared_from_this());
-    if(it == timers.end())
+int Timer::cancel(uint64_t generation) {
+    uint64_t expected = generation | ACTIVE;
+    if(!m_state.compare_exchange_strong(expected, generation | CANCELLED))
         return -1;
-    timers.erase(it);
-    m_cb = nullptr;
 
+    TimerManager* manager = m_manager;
+    if(m_shard == &manager->m_shared_shard) {
+        //destroyed once unlocked, a slab timer can be reused as soon as it is released.
+        CallBackType cb = std::move(m_cb);
+        bool pooled = m_pooled;
+        TimerManager::MutexType::Lock lock(manager->m_mutex);
+        m_shard->wheel.remove(this);
+        m_shard->next_time.store(m_shard->wheel.next_tick());
+        if(pooled) {
+            manager->release(this);
+            return 0;
+        }
+        lock.unlock();
+        manager->release(this);
+    } else if(m_shard == manager->get_current_shard()) {
+        m_shard->wheel.remove(this);
+        manager->release(this);
+    } else {
+        m_cancel_message.type = TimerMessage::CANCEL;
+        m_cancel_message.timer = this;
+        manager->post(m_shard, &m_cancel_message);
+    }
     return 0;
 }
 
 int Timer::refresh() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(!m_manager || !m_cb)
-        return -1;
-    
-    auto &timers = m_manager->m_timers;
-    auto it = timers.find(shared_from_this());
-    if(it == timers.end())
-        return -1;
-    timers.erase(it);
-    m_next_time = GetCurrentMS() + m_ms;
-    m_manager->add_timer(shared_from_this());
-    return 0;
+    return m_manager->modify(this, this->get_generation(), TimerMessage::REFRESH, 0, true);
 }
 
-int Timer::reset(int ms, bool from_now) {
-    if(ms == m_ms && !from_now)
-        return 0;
+int Timer::reset_us(uint64_t us, bool from_now) {
+    return m_manager->modify(this, this->get_generation(), TimerMessage::RESET, us, from_now);
+}
+
+void Timer::set_slack(uint64_t ms) noexcept {
+    m_slack.store(ms == DEFAULT_SLACK ? ms : ms * 1000, std::memory_order_relaxed);
+}
 
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(!m_manager || !m_cb)
+int TimerHandle::cancel() {
+    if(!m_timer)
         return -1;
-    
-    auto &timers = m_manager->m_timers;
+    return m_timer->cancel(m_generation);
+}
 
-    auto it = timers.find(shared_from_this());
-    if(it == timers.end())
+int TimerHandle::refresh() {
+    if(!m_timer)
         return -1;
-    timers.erase(it);
+    return m_timer->m_manager->modify(m_timer, m_generation, TimerMessage::REFRESH, 0, true);
+}
+
+int TimerHandle::reset_us(uint64_t us, bool from_now) {
+    if(!m_timer)
+        return -1;
+    return m_timer->m_manager->modify(m_timer, m_generation, TimerMessage::RESET, us, from_now);
+}
 
-    int start;
-    if(from_now)
-        start = GetCurrentMS();
+TimingWheel::TimingWheel(uint64_t now) noexcept
+    :m_base(now) {
+    memset(m_slots, 0, sizeof(m_slots));
+    memset(m_bitmap, 0, sizeof(m_bitmap));
+}
+
+size_t TimingWheel::get_slot(uint64_t expire) const noexcept {
+    if(expire < m_base)
+        expire = m_base;
+    uint64_t delta = expire - m_base;
+    if(delta < LEVEL0_SIZE)
+        return expire & (LEVEL0_SIZE - 1);
+
+    size_t offset = LEVEL0_SIZE;
+    size_t shift = LEVEL0_BITS;
+    for(size_t level = 1; ; ++level) {
+        uint64_t span = 1ull << (shift + LEVEL_BITS);
+        if(level == LEVEL_COUNT - 1) {
+            //beyond the wheel, park in the farthest slot and place it again on cascade.
+            if(delta >= span)
+                expire = m_base + span - 1;
+            return offset + ((expire >> shift) & (LEVEL_SIZE - 1));
+        }
+        if(delta < span)
+            return offset + ((expire >> shift) & (LEVEL_SIZE - 1));
+        offset += LEVEL_SIZE;
+        shift += LEVEL_BITS;
+    }
+}
+
+void TimingWheel::link(Timer* timer, size_t slot) noexcept {
+    Timer*& head = m_slots[slot];
+    timer->m_slot = slot;
+    timer->m_prev = nullptr;
+    timer->m_next = head;
+    if(head)
+        head->m_prev = timer;
+    head = timer;
+    m_bitmap[slot >> 6] |= 1ull << (slot & 63);
+}
+
+void TimingWheel::add(Timer* timer) noexcept {
+    this->link(timer, this->get_slot(timer->m_expire));
+    ++m_size;
+}
+
+void TimingWheel::remove(Timer* timer) noexcept {
+    if(timer->m_slot < 0)
+        return;
+    size_t slot = timer->m_slot;
+    if(timer->m_prev)
+        timer->m_prev->m_next = timer->m_next;
     else
-        start = m_next_time - m_ms;
-    m_ms = ms;
-    m_next_time = start + ms;
+        m_slots[slot] = timer->m_next;
+    if(timer->m_next)
+        timer->m_next->m_prev = timer->m_prev;
+    if(!m_slots[slot])
+        m_bitmap[slot >> 6] &= ~(1ull << (slot & 63));
+
+    timer->m_slot = -1;
+    timer->m_prev = nullptr;
+    timer->m_next = nullptr;
+    --m_size;
+}
 
-    timers.insert(shared_from_this());
-    return 0;
+void TimingWheel::cascade(size_t level, uint64_t tick) noexcept {
+    size_t shift = LEVEL0_BITS + (level - 1) * LEVEL_BITS;
+    size_t slot = LEVEL0_SIZE + (level - 1) * LEVEL_SIZE + ((tick >> shift) & (LEVEL_SIZE - 1));
+    Timer* timer = m_slots[slot];
+    m_slots[slot] = nullptr;
+    m_bitmap[slot >> 6] &= ~(1ull << (slot & 63));
+
+    while(timer) {
+        Timer* next = timer->m_next;
+        this->link(timer, this->get_slot(timer->m_expire));
+        timer = next;
+    }
+}
+
+void TimingWheel::advance(uint64_t now, std::vector<Timer*>& expired) {
+    while(m_size && m_base <= now) {
+        //jump straight to the next tick that has timers or a cascade.
+        uint64_t tick = this->next_tick();
+        if(tick > now)
+            break;
+        m_base = tick;
+
+        for(size_t level = 1; level < LEVEL_COUNT; ++level) {
+            size_t shift = LEVEL0_BITS + (level - 1) * LEVEL_BITS;
+            if(tick & ((1ull << shift) - 1))
+                break;
+            this->cascade(level, tick);
+        }
+
+        size_t slot = tick & (LEVEL0_SIZE - 1);
+        Timer* timer = m_slots[slot];
+        m_slots[slot] = nullptr;
+        m_bitmap[slot >> 6] &= ~(1ull << (slot & 63));
+        while(timer) {
+            Timer* next = timer->m_next;
+            timer->m_slot = -1;
+            timer->m_prev = nullptr;
+            timer->m_next = nullptr;
+            expired.push_back(timer);
+            --m_size;
+            timer = next;
+        }
+        m_base = tick + 1;
+    }
+    if(m_base <= now)
+        m_base = now + 1;
+}
+
+void TimingWheel::take_all(std::vector<Timer*>& timers) {
+    for(size_t i = 0; i < SLOT_COUNT / 64; ++i) {
+        uint64_t word = m_bitmap[i];
+        while(word) {
+            size_t slot = i * 64 + __builtin_ctzll(word);
+            word &= word - 1;
+            for(Timer* timer = m_slots[slot]; timer;) {
+                Timer* next = timer->m_next;
+                timer->m_slot = -1;
+                timer->m_prev = nullptr;
+                timer->m_next = nullptr;
+                timers.push_back(timer);
+                timer = next;
+            }
+            m_slots[slot] = nullptr;
+        }
+        m_bitmap[i] = 0;
+    }
+    m_size = 0;
+}
+
+void TimingWheel::reset(uint64_t now) noexcept {
+    m_base = now;
+}
+
+uint64_t TimingWheel::next_tick() const noexcept {
+    if(!m_size)
+        return NO_TIMER;
+
+    uint64_t next = NO_TIMER;
+    static const size_t LEVEL0_WORDS = LEVEL0_SIZE / 64;
+    size_t offset = m_base & (LEVEL0_SIZE - 1);
+    //level 0 slots map to single ticks, scan round from the base.
+    for(size_t i = 0; i <= LEVEL0_WORDS; ++i) {
+        size_t index = ((offset >> 6) + i) % LEVEL0_WORDS;
+        uint64_t word = m_bitmap[index];
+        if(i == 0)
+            word &= ~0ull << (offset & 63);
+        if(word) {
+            size_t slot = index * 64 + __builtin_ctzll(word);
+            next = m_base + ((slot - offset) & (LEVEL0_SIZE - 1));
+            break;
+        }
+    }
+
+    //upper level slots are due at the first boundary that maps onto them.
+    for(size_t level = 1; level < LEVEL_COUNT; ++level) {
+        uint64_t word = m_bitmap[LEVEL0_WORDS + level - 1];
+        if(!word)
+            continue;
+        size_t shift = LEVEL0_BITS + (level - 1) * LEVEL_BITS;
+        uint64_t block = (m_base + (1ull << shift) - 1) >> shift;
+        size_t index = block & (LEVEL_SIZE - 1);
+        if(index)
+            word = (word >> index) | (word << (LEVEL_SIZE - index));
+        uint64_t tick = (block + __builtin_ctzll(word)) << shift;
+        if(tick < next)
+            next = tick;
+    }
+    return next;
 }
 
 TimerManager::TimerManager() noexcept {
-    m_previous_time.store(GetCurrentMS());
 }
 
 TimerManager::~TimerManager() noexcept {
+    std::vector<TimerShard*> shards = m_shards;
+    shards.push_back(&m_shared_shard);
+    for(TimerShard* shard : shards) {
+        this->process_messages(shard);
+        shard->wheel.take_all(shard->expired);
+        for(Timer* timer : shard->expired)
+            timer->m_self.reset();
+        for(Timer* slab : shard->slabs)
+            delete[] slab;
+    }
+    for(TimerShard* shard : m_shards)
+        delete shard;
+}
 
+void TimerManager::init_timer_shards(size_t count) {
+    for(size_t i = m_shards.size(); i < count; ++i)
+        m_shards.push_back(new TimerShard);
 }
 
-Timer::ptr TimerManager::add_timer(int ms, Timer::CallBackType cb, bool recurring) {
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
-    RWMutexType::WriteLock lock(m_mutex);
-    add_timer(timer);
+TimerShard* TimerManager::get_current_shard() noexcept {
+    size_t index = this->get_timer_shard_index();
+    if(index < m_shards.size())
+        return m_shards[index];
+    return &m_shared_shard;
+}
+
+Timer::ptr TimerManager::add_timer(uint64_t ms, Timer::CallBackType cb, bool recurring) {
+    return this->add_timer_us(ms * 1000, std::move(cb), recurring);
+}
+
+Timer::ptr TimerManager::add_timer_us(uint64_t us, Timer::CallBackType cb, bool recurring) {
+    Timer::ptr timer(new Timer(us, cb, recurring, this));
+    TimerShard* shard = this->get_current_shard();
+    timer->m_shard = shard;
+    timer->m_self = timer;
+    ++m_timer_count;
+    if(shard != &m_shared_shard) {
+        this->link(shard, timer.get());
+        return timer;
+    }
+
+    MutexType::Lock lock(m_mutex);
+    bool at_front = this->link(shard, timer.get());
+    lock.unlock();
+    if(at_front)
+        this->on_timer_inserted_into_front();
     return timer;
 }
 
-void TimerManager::add_timer(Timer::ptr timer) {
-    auto it = m_timers.insert(timer);
-    bool tickle = (it.first == m_timers.begin()) && !m_tickled;
-    if(!tickle)
-        return;
-    m_tickled.store(true);
-    m_mutex.unlock();
+TimerHandle TimerManager::add_timer_handle(uint64_t ms, Timer::CallBackType cb, bool recurring) {
+    return this->add_timer_handle_us(ms * 1000, std::move(cb), recurring);
+}
+
+TimerHandle TimerManager::add_timer_handle_us(uint64_t us, Timer::CallBackType cb, bool recurring) {
+    TimerShard* shard = this->get_current_shard();
+    MutexType::Lock lock(m_mutex, shard == &m_shared_shard);
+    Timer* timer = this->acquire(shard);
+    timer->init(us, std::move(cb), recurring);
+    //read before linking, once linked the shared wheel may recycle it.
+    uint64_t generation = timer->get_generation();
+    ++m_timer_count;
+    bool at_front = this->link(shard, timer);
+    lock.unlock();
+    if(at_front)
+        this->on_timer_inserted_into_front();
+    return TimerHandle(timer, generation);
+}
+
+Timer* TimerManager::acquire(TimerShard* shard) {
+    static const size_t SLAB_SIZE = 64;
+    if(!shard->free_list) {
+        Timer* slab = new Timer[SLAB_SIZE];
+        shard->slabs.push_back(slab);
+        for(size_t i = 0; i < SLAB_SIZE; ++i) {
+            slab[i].m_pooled = true;
+            slab[i].m_manager = this;
+            slab[i].m_shard = shard;
+            slab[i].m_next = shard->free_list;
+            shard->free_list = &slab[i];
+        }
+    }
+    Timer* timer = shard->free_list;
+    shard->free_list = timer->m_next;
+    timer->m_next = nullptr;
+    timer->m_state.store(timer->get_generation() | Timer::ACTIVE);
+    return timer;
+}
+
+static uint64_t ApplySlack(uint64_t time, uint64_t slack) noexcept {
+    if(slack < 2)
+        return time;
+    uint64_t granularity = 1ull << (63 - __builtin_clzll(slack));
+    return (time + granularity - 1) & ~(granularity - 1);
+}
+
+void TimerManager::arm(TimerShard* shard, Timer* timer) noexcept {
+    uint64_t slack = timer->m_slack.load(std::memory_order_relaxed);
+    if(slack == Timer::DEFAULT_SLACK)
+        slack = m_slack.load(std::memory_order_relaxed);
+    timer->m_expire = ApplySlack(timer->m_next_time, slack);
+    shard->wheel.add(timer);
+}
+
+bool TimerManager::link(TimerShard* shard, Timer* timer) noexcept {
+    TimingWheel& wheel = shard->wheel;
+    if(wheel.empty())
+        wheel.reset(GetCachedUS());
+    this->arm(shard, timer);
+    //a worker recomputes its own timeout before it sleeps,
+    //only the shared wheel has to wake somebody.
+    if(shard != &m_shared_shard)
+        return false;
+    uint64_t next_time = wheel.next_tick();
+    return next_time < shard->next_time.exchange(next_time)
+        && !m_tickled.exchange(true);
+}
+
+int TimerManager::modify(Timer* timer, uint64_t generation, TimerMessage::Type type, uint64_t us, bool from_now) {
+    TimerShard* shard = timer->m_shard;
+    if(shard == &m_shared_shard) {
+        MutexType::Lock lock(m_mutex);
+        if(timer->m_state.load() != (generation | Timer::ACTIVE))
+            return -1;
+        bool at_front = this->apply(shard, timer, type, us, from_now);
+        lock.unlock();
+        if(at_front)
+            this->on_timer_inserted_into_front();
+        return 0;
+    }
+    if(timer->m_state.load() != (generation | Timer::ACTIVE))
+        return -1;
+    if(shard == this->get_current_shard()) {
+        this->apply(shard, timer, type, us, from_now);
+        return 0;
+    }
+
+    //the owner applies it on its next loop, wake the idle workers in case it sleeps.
+    TimerMessage* message = new TimerMessage;
+    message->type = type;
+    message->timer = timer;
+    if(!timer->m_pooled)
+        message->holder = timer->shared_from_this();
+    message->generation = generation;
+    message->us = us;
+    message->from_now = from_now;
+    this->post(shard, message);
     this->on_timer_inserted_into_front();
+    return 0;
+}
+
+bool TimerManager::apply(TimerShard* shard, Timer* timer, TimerMessage::Type type
+                        , uint64_t us, bool from_now) noexcept {
+    if(timer->m_slot < 0)
+        return false;
+    if(type == TimerMessage::RESET) {
+        if(us == timer->m_us && !from_now)
+            return false;
+        uint64_t start;
+        if(from_now)
+            start = GetStartUS(us);
+        else
+            start = timer->m_next_time - timer->m_us;
+        timer->m_us = us;
+        timer->m_next_time = start + us;
+    } else {
+        timer->m_next_time = GetStartUS(timer->m_us) + timer->m_us;
+    }
+    shard->wheel.remove(timer);
+    return this->link(shard, timer);
+}
+
+void TimerManager::release(Timer* timer) noexcept {
+    timer->m_cb = nullptr;
+    --m_timer_count;
+    if(!timer->m_pooled) {
+        timer->m_self.reset();
+        return;
+    }
+    //a new generation turns away handles to the old timer.
+    timer->m_state.store(timer->get_generation() + Timer::GENERATION_STEP + Timer::DONE);
+    timer->m_next = timer->m_shard->free_list;
+    timer->m_shard->free_list = timer;
+}
+
+void TimerManager::post(TimerShard* shard, TimerMessage* message) noexcept {
+    message->next = shard->inbox.load(std::memory_order_relaxed);
+    while(!shard->inbox.compare_exchange_weak(message->next, message
+            , std::memory_order_release, std::memory_order_relaxed));
+}
+
+void TimerManager::process_messages(TimerShard* shard) noexcept {
+    if(!shard->inbox.load(std::memory_order_relaxed))
+        return;
+    TimerMessage* message = shard->inbox.exchange(nullptr, std::memory_order_acquire);
+    //the inbox is a stack, restore the posting order.
+    TimerMessage* ordered = nullptr;
+    while(message) {
+        TimerMessage* next = message->next;
+        message->next = ordered;
+        ordered = message;
+        message = next;
+    }
+
+    while(ordered) {
+        TimerMessage* next = ordered->next;
+        Timer* timer = ordered->timer;
+        if(ordered->type == TimerMessage::CANCEL) {
+            shard->wheel.remove(timer);
+            this->release(timer);
+        } else {
+            if(timer->m_state.load() == (ordered->generation | Timer::ACTIVE))
+                this->apply(shard, timer, ordered->type, ordered->us, ordered->from_now);
+            delete ordered;
+        }
+        ordered = next;
+    }
 }
 
 static void OnTimer(std::weak_ptr<void> cond, std::function<void()> cb) {
@@ -122,89 +494,130 @@ static void OnTimer(std::weak_ptr<void> cond, std::function<void()> cb) {
     cb();
 }
 
-Timer::ptr TimerManager::add_cond_timer(int ms, Timer::CallBackType cb, std::weak_ptr<void> cond, bool recurring) {
+Timer::ptr TimerManager::add_cond_timer(uint64_t ms, Timer::CallBackType cb, std::weak_ptr<void> cond, bool recurring) {
     return this->add_timer(ms, std::bind(&OnTimer, cond, cb), recurring);
 }
 
-int TimerManager::get_next_time() noexcept {
+uint64_t TimerManager::get_next_time() noexcept {
     m_tickled.store(false);
-    int  now_time = GetCurrentMS();
-    this->detect_clock_rollover(now_time);
-
-    RWMutexType::ReadLock lock(m_mutex);
-    if(m_timers.empty())
-        return INT_MAX;
-    
-    const Timer::ptr& next = *m_timers.begin();
-    if(now_time >= next->m_next_time)
+    uint64_t now_time = GetCachedUS();
+    uint64_t next_time = m_shared_shard.next_time.load(std::memory_order_relaxed);
+    TimerShard* shard = this->get_current_shard();
+    if(shard != &m_shared_shard) {
+        this->process_messages(shard);
+        next_time = std::min(next_time, shard->wheel.next_tick());
+    }
+
+    if(next_time == TimingWheel::NO_TIMER)
+        return TimingWheel::NO_TIMER;
+    if(now_time >= next_time)
         return 0;
-    
-    return next->m_next_time;
+    return next_time;
 }
 
-bool TimerManager::has_timer() noexcept {
-    RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+void TimerManager::expire(TimerShard* shard, uint64_t now, std::vector<Timer::CallBackType>& cbs) {
+    std::vector<Timer*>& expired = shard->expired;
+    shard->wheel.advance(now, expired);
+    if(!expired.empty())
+        this->count_coalesced(shard);
+    for(Timer* timer : expired) {
+        //a timer cancelled by another thread is released by its cancel message.
+        uint64_t generation = timer->get_generation();
+        if(timer->m_recurring) {
+            if(timer->m_state.load() != (generation | Timer::ACTIVE))
+                continue;
+            cbs.push_back(timer->m_cb);
+            timer->m_next_time = now + timer->m_us;
+            this->arm(shard, timer);
+            continue;
+        }
+        uint64_t expected = generation | Timer::ACTIVE;
+        if(!timer->m_state.compare_exchange_strong(expected, generation | Timer::DONE))
+            continue;
+        cbs.push_back(std::move(timer->m_cb));
+        this->release(timer);
+    }
+    expired.clear();
+    if(shard == &m_shared_shard)
+        shard->next_time.store(shard->wheel.next_tick());
 }
 
-void TimerManager::detect_clock_rollover(int now_time) noexcept {
-    if(LIKELY(now_time >= m_previous_time ||
-            now_time >= (m_previous_time - 60 * 60 *1000))) {
-        m_previous_time.store(now_time);
-        return;
-    }
-    
-    int distance = now_time - m_previous_time;
-    RWMutex::WriteLock lock(m_mutex);
-    for (auto it = m_timers.begin(); it != m_timers.end(); ++it)
-        (*it)->m_next_time -= distance;
-    lock.unlock();
+void TimerManager::list_expired_cb(std::vector<Timer::CallBackType>& expired_cbs) {
+    uint64_t now_time = GetCachedUS();
 
-    m_previous_time.store(now_time);
+    TimerShard* shard = this->get_current_shard();
+    if(shard != &m_shared_shard) {
+        this->process_messages(shard);
+        this->expire(shard, now_time, expired_cbs);
+    }
+    if(m_shared_shard.next_time.load(std::memory_order_relaxed) <= now_time) {
+        MutexType::Lock lock(m_mutex);
+        this->expire(&m_shared_shard, now_time, expired_cbs);
+    }
 }
 
-std::vector<Timer::CallBackType> TimerManager::list_expired_cb() {
-    int now_time = GetCurrentMS();
-
-    RWMutexType::ReadLock lock1(m_mutex);
-    if(m_timers.empty())
-        return std::vector<Timer::CallBackType>();
-    lock1.unlock();
+void TimerManager::count_coalesced(TimerShard* shard) noexcept {
+    size_t coalesced = 0;
+    for(Timer* timer : shard->expired) {
+        if(timer->m_expire != timer->m_next_time)
+            ++coalesced;
+    }
+    m_expired_count.fetch_add(shard->expired.size(), std::memory_order_relaxed);
+    if(!coalesced)
+        return;
+    m_coalesced_count.fetch_add(coalesced, std::memory_order_relaxed);
+
+    //every distinct deadline would have been its own wakeup without slack.
+    std::vector<uint64_t>& deadlines = shard->deadlines;
+    for(Timer* timer : shard->expired)
+        deadlines.push_back(timer->m_next_time);
+    std::sort(deadlines.begin(), deadlines.end());
+    size_t wanted = std::unique(deadlines.begin(), deadlines.end()) - deadlines.begin();
+    deadlines.clear();
+    for(Timer* timer : shard->expired)
+        deadlines.push_back(timer->m_expire);
+    std::sort(deadlines.begin(), deadlines.end());
+    size_t used = std::unique(deadlines.begin(), deadlines.end()) - deadlines.begin();
+    deadlines.clear();
+    if(wanted > used)
+        m_wakeups_saved.fetch_add(wanted - used, std::memory_order_relaxed);
+}
 
-    std::vector<Timer::CallBackType> expired_cbs;
-    std::vector<Timer::ptr> cache_timers;
-    
-    RWMutexType::WriteLock lock2(m_mutex);
+TimerMetrics TimerManager::get_timer_metrics() const noexcept {
+    TimerMetrics metrics;
+    metrics.timers = m_timer_count.load(std::memory_order_relaxed);
+    metrics.expired = m_expired_count.load(std::memory_order_relaxed);
+    metrics.coalesced = m_coalesced_count.load(std::memory_order_relaxed);
+    metrics.wakeups_saved = m_wakeups_saved.load(std::memory_order_relaxed);
+    return metrics;
+}
 
-    Timer::ptr now_timer(new Timer(now_time));
-    auto end_pos = m_timers.upper_bound(now_timer);
-   
-    for(auto it = m_timers.begin(); it != end_pos; ++it) {
-        auto timer = *it;
-        expired_cbs.push_back(timer->m_cb);
-        if(timer->m_recurring) {
-            timer->m_next_time = now_time + timer->m_ms;
-            cache_timers.push_back(timer);
-        } else {
-            timer->m_cb = nullptr;
+void TimerManager::erase_recurring(TimerShard* shard) noexcept {
+    std::vector<Timer*>& timers = shard->expired;
+    shard->wheel.take_all(timers);
+    for(Timer* timer : timers) {
+        if(!timer->m_recurring) {
+            shard->wheel.add(timer);
+            continue;
         }
+        uint64_t generation = timer->get_generation();
+        uint64_t expected = generation | Timer::ACTIVE;
+        if(timer->m_state.compare_exchange_strong(expected, generation | Timer::CANCELLED))
+            this->release(timer);
     }
-
-    m_timers.erase(m_timers.begin(), end_pos);
-    for(auto timer : cache_timers) {
-        this->add_timer(timer);
-    }
-    return expired_cbs;
+    timers.clear();
 }
 
 void TimerManager::timer_manager_stop() noexcept {
-    RWMutexType::WriteLock lock(m_mutex);
-    for(auto it = m_timers.begin(); it != m_timers.end();) {
-        if((*it)->m_recurring)
-            it = m_timers.erase(it);
-        else 
-            ++it;
+    TimerShard* shard = this->get_current_shard();
+    if(shard != &m_shared_shard) {
+        this->process_messages(shard);
+        this->erase_recurring(shard);
     }
+
+    MutexType::Lock lock(m_mutex);
+    this->erase_recurring(&m_shared_shard);
+    m_shared_shard.next_time.store(m_shared_shard.wheel.next_tick());
 }
 
 } // namespace qff
@@ -3,68 +3,246 @@
 
 #include <memory>
 #include <atomic>
-#include <set>
+#include <vector>
 #include "thread.h"
 #include "macro.h"
 
 namespace qff {
 
+class Timer;
 class TimerManager;
+class TimingWheel;
+struct TimerShard;
+
+//request sent to the worker owning a timer by another thread.
+struct TimerMessage {
+    enum Type {
+        CANCEL,
+        REFRESH,
+        RESET
+    };
+    Type type = CANCEL;
+    TimerMessage* next = nullptr;
+    Timer* timer = nullptr;
+    //keeps a shared timer alive while a refresh or reset is queued.
+    std::shared_ptr<Timer> holder;
+    //the message is dropped if the timer was recycled meanwhile.
+    uint64_t generation = 0;
+    uint64_t us = 0;
+    bool from_now = false;
+};
 
 class Timer final : public std::enable_shared_from_this<Timer> {
 friend TimerManager;
+friend TimingWheel;
+friend class TimerHandle;
 public:
     typedef std::shared_ptr<Timer> ptr;
     typedef std::function<void()> CallBackType;
 
+    enum State {
+        ACTIVE,
+        CANCELLED,
+        DONE
+    };
+    static constexpr uint64_t DEFAULT_SLACK = ~0ull;
+
+    //slack lets the timer fire up to ms late so it can share a wakeup with
+    //others, DEFAULT_SLACK uses the manager's slack. takes effect when the
+    //timer is next armed.
+    void set_slack(uint64_t ms) noexcept;
+
+    //from a thread other than the owning worker these are queued to the owner.
+    //a cancel takes effect at once, a refresh or reset is applied on the
+    //owner's next loop and no later than the old deadline.
     int cancel();
     int refresh();
-    int reset(int ms, bool from_now);
+    int reset(uint64_t ms, bool from_now) { return this->reset_us(ms * 1000, from_now); }
+    int reset_us(uint64_t us, bool from_now);
 private:
-    Timer(int ms, CallBackType cb, bool recurring, TimerManager* manager);
-    Timer(int next_time);
+    //m_state keeps the State in its low bits and the generation above them.
+    static constexpr uint64_t STATE_MASK = 3;
+    static constexpr uint64_t GENERATION_STEP = 4;
+
+    Timer() noexcept {}
+    Timer(uint64_t us, CallBackType cb, bool recurring, TimerManager* manager);
+    void init(uint64_t us, CallBackType&& cb, bool recurring) noexcept;
+    uint64_t get_generation() const noexcept { return m_state.load() & ~STATE_MASK; }
+    int cancel(uint64_t generation);
 private:
     bool m_recurring = false;
-    int m_ms;
-    int m_next_time;
+    //set for slab timers, they go back to their shard's free list when released.
+    bool m_pooled = false;
+    //interval and deadline in us.
+    uint64_t m_us = 0;
+    uint64_t m_next_time = 0;
+    //m_next_time rounded up by the slack, the wheel is keyed on it.
+    uint64_t m_expire = 0;
+    std::atomic<uint64_t> m_slack = {DEFAULT_SLACK};
     CallBackType m_cb;
-    TimerManager* m_manager;
+    TimerManager* m_manager = nullptr;
+    TimerShard* m_shard = nullptr;
+    std::atomic<uint64_t> m_state = {ACTIVE};
+    TimerMessage m_cancel_message;
+
+    //wheel and free list linkage, the wheel keeps a shared timer alive through m_self while linked.
+    int16_t m_slot = -1;
+    Timer* m_prev = nullptr;
+    Timer* m_next = nullptr;
+    Timer::ptr m_self;
+};
+
+//refers to a slab timer without owning it. the node is recycled once the timer
+//fires or is cancelled, after that every call on an old handle returns -1.
+class TimerHandle final {
+friend TimerManager;
+public:
+    TimerHandle() noexcept {}
+
+    int cancel();
+    int refresh();
+    int reset(uint64_t ms, bool from_now) { return this->reset_us(ms * 1000, from_now); }
+    int reset_us(uint64_t us, bool from_now);
+    explicit operator bool() const noexcept { return m_timer != nullptr; }
 private:
-    struct Comparator {
-        bool operator()(const Timer::ptr lhs, const Timer::ptr rhs) const noexcept;
-    };
+    TimerHandle(Timer* timer, uint64_t generation) noexcept
+        :m_timer(timer)
+        ,m_generation(generation) {
+    }
+private:
+    Timer* m_timer = nullptr;
+    uint64_t m_generation = 0;
 };
 
+//hierarchical timing wheel with 1us ticks of the cached monotonic clock, O(1) add and remove.
+//level 0 has 256 slots of one tick, levels 1-4 have 64 slots each
+//and are cascaded down as time reaches them, the top level spans 71 minutes.
+class TimingWheel final {
+public:
+    NONECOPYABLE(TimingWheel);
+    static constexpr uint64_t NO_TIMER = ~0ull;
+
+    TimingWheel(uint64_t now = 0) noexcept;
+
+    void add(Timer* timer) noexcept;
+    void remove(Timer* timer) noexcept;
+    //unlinks every timer due at or before now, in deadline order.
+    void advance(uint64_t now, std::vector<Timer*>& expired);
+    void take_all(std::vector<Timer*>& timers);
+    //only valid on an empty wheel.
+    void reset(uint64_t now) noexcept;
+
+    //the earliest tick the wheel has work at, a lower bound for timers above level 0.
+    uint64_t next_tick() const noexcept;
+    size_t size() const noexcept { return m_size; }
+    bool empty() const noexcept { return m_size == 0; }
+private:
+    static constexpr size_t LEVEL0_BITS = 8;
+    static constexpr size_t LEVEL_BITS = 6;
+    static constexpr size_t LEVEL_COUNT = 5;
+    static constexpr size_t LEVEL0_SIZE = 1 << LEVEL0_BITS;
+    static constexpr size_t LEVEL_SIZE = 1 << LEVEL_BITS;
+    static constexpr size_t SLOT_COUNT = LEVEL0_SIZE + (LEVEL_COUNT - 1) * LEVEL_SIZE;
+
+    size_t get_slot(uint64_t expire) const noexcept;
+    void link(Timer* timer, size_t slot) noexcept;
+    void cascade(size_t level, uint64_t tick) noexcept;
+private:
+    uint64_t m_base;
+    size_t m_size = 0;
+    Timer* m_slots[SLOT_COUNT];
+    uint64_t m_bitmap[SLOT_COUNT / 64];
+};
+
+//timers owned by one worker, other threads only reach it through the inbox.
+struct TimerShard {
+    TimingWheel wheel;
+    std::atomic<TimerMessage*> inbox = {nullptr};
+    //earliest tick of the wheel, readable without owning the shard.
+    std::atomic<uint64_t> next_time = {TimingWheel::NO_TIMER};
+    std::vector<Timer*> expired;
+    std::vector<uint64_t> deadlines;
+    //slab of recycled timers, only touched by the owner.
+    Timer* free_list = nullptr;
+    std::vector<Timer*> slabs;
+};
+
+struct TimerMetrics {
+    uint64_t timers = 0;
+    uint64_t expired = 0;
+    //timers fired at a deadline moved by their slack.
+    uint64_t coalesced = 0;
+    //distinct deadlines that shared a wakeup with another one.
+    uint64_t wakeups_saved = 0;
+};
+
+//every worker keeps its own wheel, timers added outside the workers
+//go to a shared wheel guarded by a spinlock.
 class TimerManager {
 friend class Timer;
+friend class TimerHandle;
 public:
     NONECOPYABLE(TimerManager);
-    typedef RWMutex RWMutexType;
+    typedef SpinLock MutexType;
 
     TimerManager() noexcept;
     virtual ~TimerManager() noexcept;
 
-    Timer::ptr add_timer(int ms, Timer::CallBackType cb, bool recurring = false);
-    Timer::ptr add_cond_timer(int ms, Timer::CallBackType cb, std::weak_ptr<void> cond, bool recurring = false);
+    Timer::ptr add_timer(uint64_t ms, Timer::CallBackType cb, bool recurring = false);
+    Timer::ptr add_timer_us(uint64_t us, Timer::CallBackType cb, bool recurring = false);
+    Timer::ptr add_cond_timer(uint64_t ms, Timer::CallBackType cb, std::weak_ptr<void> cond, bool recurring = false);
+    //timers taken from the calling thread's slab, nothing is allocated in steady state
+    //as long as the callback fits in std::function's local storage.
+    TimerHandle add_timer_handle(uint64_t ms, Timer::CallBackType cb, bool recurring = false);
+    TimerHandle add_timer_handle_us(uint64_t us, Timer::CallBackType cb, bool recurring = false);
+
+    //absolute time in us of the calling worker's next timer, 0 if one is due,
+    //TimingWheel::NO_TIMER if none.
+    uint64_t get_next_time() noexcept;
+    bool has_timer() noexcept { return m_timer_count.load(std::memory_order_relaxed) > 0; }
 
-    int get_next_time() noexcept;
-    bool has_timer() noexcept;
+    //timers due within a window of the largest power of two not above
+    //ms fire together, 0 disables it.
+    void set_timer_slack(uint64_t ms) noexcept { m_slack.store(ms * 1000, std::memory_order_relaxed); }
+    uint64_t get_timer_slack() const noexcept { return m_slack.load(std::memory_order_relaxed) / 1000; }
+    TimerMetrics get_timer_metrics() const noexcept;
 protected:
     virtual void on_timer_inserted_into_front() noexcept = 0;
+    //index of the calling thread's shard, -1 for threads without one.
+    virtual size_t get_timer_shard_index() const noexcept { return -1; }
 
-    std::vector<Timer::CallBackType> list_expired_cb();
+    //must be called before any worker starts.
+    void init_timer_shards(size_t count);
+    //appends the expired callbacks, the caller reuses the buffer across loops.
+    void list_expired_cb(std::vector<Timer::CallBackType>& cbs);
     void timer_manager_stop() noexcept;
 private:
-    void add_timer(Timer::ptr timer);
-    void detect_clock_rollover(int now_ms) noexcept;
+    TimerShard* get_current_shard() noexcept;
+    void post(TimerShard* shard, TimerMessage* message) noexcept;
+    void process_messages(TimerShard* shard) noexcept;
+    void expire(TimerShard* shard, uint64_t now, std::vector<Timer::CallBackType>& cbs);
+    void erase_recurring(TimerShard* shard) noexcept;
+    void count_coalesced(TimerShard* shard) noexcept;
+    void arm(TimerShard* shard, Timer* timer) noexcept;
+    Timer* acquire(TimerShard* shard);
+    //links the timer, returns true if the caller should tickle once unlocked.
+    bool link(TimerShard* shard, Timer* timer) noexcept;
+    int modify(Timer* timer, uint64_t generation, TimerMessage::Type type, uint64_t us, bool from_now);
+    bool apply(TimerShard* shard, Timer* timer, TimerMessage::Type type, uint64_t us, bool from_now) noexcept;
+    void release(Timer* timer) noexcept;
 private:
-    std::atomic<int> m_previous_time = {-1};
     std::atomic<bool> m_tickled = {false};
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
-    RWMutexType m_mutex;
+    std::atomic<size_t> m_timer_count = {0};
+    std::atomic<uint64_t> m_slack = {0};
+    std::atomic<uint64_t> m_expired_count = {0};
+    std::atomic<uint64_t> m_coalesced_count = {0};
+    std::atomic<uint64_t> m_wakeups_saved = {0};
+    std::vector<TimerShard*> m_shards;
+    TimerShard m_shared_shard;
+    MutexType m_mutex;
 };
 
 } // namespace qff
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,242 @@
+#include "write_queue.h"
+#include "hook.h"
+#include "log.h"
+
+#include <string.h>
+
+namespace qff {
+
+static const size_t MAX_WRITE_IOVS = 64;
+
+static std::atomic<size_t> s_total_queued = {0};
+
+//a write or flush parked until the queue is short enough, kept on the fiber's stack.
+struct WriteQueue::Waiter : public FiberWaiter {
+    size_t target;
+};
+
+WriteQueue::WriteQueue(IOManager* iom, Socket::ptr sock, size_t high_watermark,
+                       size_t low_watermark, size_t max_queued)
+    :m_iom(iom)
+    ,m_sock(sock)
+    ,m_high_watermark(high_watermark)
+    ,m_low_watermark(std::min(low_watermark, high_watermark))
+    ,m_max_queued(std::max(max_queued, high_watermark)) {
+}
+
+WriteQueue::~WriteQueue() noexcept {
+    this->clear_chunks();
+}
+
+size_t WriteQueue::GetTotalQueued() noexcept {
+    return s_total_queued.load(std::memory_order_relaxed);
+}
+
+int WriteQueue::write(const void* data, size_t length, uint64_t timeout_ms) {
+    return this->enqueue(std::string((const char*)data, length), timeout_ms);
+}
+
+int WriteQueue::write(std::string&& data, uint64_t timeout_ms) {
+    return this->enqueue(std::move(data), timeout_ms);
+}
+
+int WriteQueue::flush(uint64_t timeout_ms) {
+    if(this->wait(0, timeout_ms))
+        return -1;
+    MutexType::Lock lock(m_mutex);
+    if(m_closed) {
+        errno = m_error ? m_error : EPIPE;
+        return -1;
+    }
+    return 0;
+}
+
+void WriteQueue::close() {
+    std::vector<Fiber::ptr> fibers;
+    bool writing;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_closed)
+            return;
+        m_closed = true;
+        writing = m_writing;
+        //the writer may still point into the chunks, it drops them itself.
+        if(!writing)
+            this->clear_chunks();
+        this->wake_waiters(fibers);
+    }
+    for(auto& i : fibers)
+        m_iom->schedule(i);
+    if(writing)
+        m_iom->cancel_event(m_sock->get_socket(), IOManager::WRITE);
+}
+
+int WriteQueue::enqueue(std::string&& data, uint64_t timeout_ms) {
+    size_t length = data.size();
+    if(!length)
+        return 0;
+    bool full;
+    {
+        MutexType::Lock lock(m_mutex);
+        full = !m_closed && get_queued() > m_high_watermark;
+        if(full)
+            m_parks.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(full && this->wait(m_low_watermark, timeout_ms))
+        return -1;
+
+    bool start = false;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_closed) {
+            errno = m_error ? m_error : EPIPE;
+            return -1;
+        }
+        size_t queued = get_queued();
+        if(queued + length > m_max_queued) {
+            errno = ENOBUFS;
+            return -1;
+        }
+        m_chunks.push_back(std::move(data));
+        m_queued.store(queued + length, std::memory_order_relaxed);
+        s_total_queued.fetch_add(length, std::memory_order_relaxed);
+        if(queued + length > get_peak_queued())
+            m_peak_queued.store(queued + length, std::memory_order_relaxed);
+        if(!m_writing)
+            start = m_writing = true;
+    }
+    if(start) {
+        auto self = shared_from_this();
+        m_iom->schedule([self]{ self->run_writer(); });
+    }
+    return length;
+}
+
+int WriteQueue::wait(size_t target, uint64_t timeout_ms) {
+    Waiter waiter;
+    waiter.target = target;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_closed || get_queued() <= target)
+            return 0;
+        waiter.park(m_waiters, m_mutex);
+    }
+    if(!waiter.wait(m_iom, timeout_ms)) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+void WriteQueue::wake_waiters(std::vector<Fiber::ptr>& fibers) {
+    size_t queued = get_queued();
+    for(auto it = m_waiters.begin(); it != m_waiters.end();) {
+        Waiter* waiter = static_cast<Waiter*>(*it++);
+        if(m_closed || queued <= waiter->target)
+            fibers.push_back(waiter->wake());
+    }
+}
+
+void WriteQueue::clear_chunks() {
+    size_t queued = m_queued.exchange(0, std::memory_order_relaxed);
+    s_total_queued.fetch_sub(queued, std::memory_order_relaxed);
+    m_chunks.clear();
+    m_offset = 0;
+}
+
+void WriteQueue::run_writer() {
+    set_hook_enable(true);
+    int fd = m_sock->get_socket();
+    iovec iovs[MAX_WRITE_IOVS];
+    while(true) {
+        size_t count = 0;
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_closed || m_chunks.empty()) {
+                if(m_closed)
+                    this->clear_chunks();
+                m_writing = false;
+                return;
+            }
+            //producers only push at the back, the chunks stay put while unlocked.
+            size_t offset = m_offset;
+            for(auto it = m_chunks.begin(); it != m_chunks.end() && count < MAX_WRITE_IOVS; ++it) {
+                iovs[count].iov_base = &(*it)[offset];
+                iovs[count].iov_len = it->size() - offset;
+                offset = 0;
+                ++count;
+            }
+        }
+
+        //writev that neither raises SIGPIPE nor parks in the hook, so close() can stop it.
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iovs;
+        msg.msg_iovlen = count;
+        ssize_t rt = ::sendmsg_f(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(rt == -1) {
+            if(errno == EINTR)
+                continue;
+            if(errno != EAGAIN) {
+                this->fail(errno);
+                continue;
+            }
+            if(m_iom->add_event(fd, IOManager::WRITE)) {
+                this->fail(EBADF);
+                continue;
+            }
+            bool closed;
+            {
+                MutexType::Lock lock(m_mutex);
+                closed = m_closed;
+            }
+            //close() may have run its cancel_event before the event was added.
+            if(closed) {
+                m_iom->del_event(fd, IOManager::WRITE);
+                continue;
+            }
+            Fiber::YieldToHold();
+            continue;
+        }
+
+        std::vector<Fiber::ptr> fibers;
+        {
+            MutexType::Lock lock(m_mutex);
+            size_t left = rt;
+            while(left) {
+                size_t rest = m_chunks.front().size() - m_offset;
+                if(rest > left) {
+                    m_offset += left;
+                    break;
+                }
+                left -= rest;
+                m_chunks.pop_front();
+                m_offset = 0;
+            }
+            m_queued.fetch_sub(rt, std::memory_order_relaxed);
+            s_total_queued.fetch_sub(rt, std::memory_order_relaxed);
+            m_sent.fetch_add(rt, std::memory_order_relaxed);
+            this->wake_waiters(fibers);
+        }
+        for(auto& i : fibers)
+            m_iom->schedule(i);
+    }
+}
+
+void WriteQueue::fail(int error) {
+    QFF_LOG_ERROR(QFF_LOG_SYSTEM) << "WriteQueue " << m_sock->to_string() << " send failed errno="
+        << error << " errstr=" << ::strerror(error);
+    std::vector<Fiber::ptr> fibers;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(!m_closed) {
+            m_closed = true;
+            m_error = error;
+        }
+        this->wake_waiters(fibers);
+    }
+    for(auto& i : fibers)
+        m_iom->schedule(i);
+}
+
+} // namespace qff
@@ -0,0 +1,89 @@
+#ifndef __QFF_WRITE_QUEUE_H__
+#define __QFF_WRITE_QUEUE_H__
+
+#include <memory>
+#include <string>
+#include <deque>
+#include <list>
+#include <vector>
+#include <atomic>
+
+#include "socket.h"
+#include "io_manager.h"
+#include "thread.h"
+#include "fiber_waiter.h"
+
+namespace qff {
+
+//bounded write queue shared by the fibers producing for one connection.
+//a single writer fiber drains it with writev. producers park once more than
+//the high watermark is queued and resume when it falls to the low watermark,
+//no connection may hold more than max_queued bytes. create it with std::make_shared.
+class WriteQueue final : public std::enable_shared_from_this<WriteQueue> {
+public:
+    NONECOPYABLE(WriteQueue);
+    typedef std::shared_ptr<WriteQueue> ptr;
+    typedef SpinLock MutexType;
+
+    WriteQueue(IOManager* iom, Socket::ptr sock, size_t high_watermark = 256 * 1024,
+               size_t low_watermark = 64 * 1024, size_t max_queued = 4 * 1024 * 1024);
+    ~WriteQueue() noexcept;
+
+    //the write calls return length or -1. errno is ETIMEDOUT when the wait for
+    //the low watermark ran out, ENOBUFS over max_queued, or the send error once
+    //the queue is closed. call them from a fiber.
+    int write(const void* data, size_t length, uint64_t timeout_ms = -1);
+    int write(std::string&& data, uint64_t timeout_ms = -1);
+    //waits until everything queued was handed to the kernel, returns 0 or -1.
+    int flush(uint64_t timeout_ms = -1);
+    //drops what is queued and fails every waiting and later write with EPIPE.
+    void close();
+
+    Socket::ptr get_socket() const noexcept { return m_sock;}
+    size_t get_queued() const noexcept { return m_queued.load(std::memory_order_relaxed);}
+    size_t get_peak_queued() const noexcept { return m_peak_queued.load(std::memory_order_relaxed);}
+    uint64_t get_sent() const noexcept { return m_sent.load(std::memory_order_relaxed);}
+    //writes that parked on the high watermark.
+    uint64_t get_parks() const noexcept { return m_parks.load(std::memory_order_relaxed);}
+    bool is_closed() const noexcept { return m_closed.load(std::memory_order_relaxed);}
+
+    //bytes queued by every WriteQueue of the process.
+    static size_t GetTotalQueued() noexcept;
+private:
+    struct Waiter;
+
+    int enqueue(std::string&& data, uint64_t timeout_ms);
+    //parks until at most target bytes are queued or the queue is closed.
+    int wait(size_t target, uint64_t timeout_ms);
+    //takes the waiters that may go on, locked.
+    void wake_waiters(std::vector<Fiber::ptr>& fibers);
+    //drops the queued bytes from the accounting, locked.
+    void clear_chunks();
+    void run_writer();
+    void fail(int error);
+private:
+    IOManager* m_iom;
+    Socket::ptr m_sock;
+    size_t m_high_watermark;
+    size_t m_low_watermark;
+    size_t m_max_queued;
+
+    MutexType m_mutex;
+    std::deque<std::string> m_chunks;
+    //bytes of the front chunk already sent.
+    size_t m_offset = 0;
+    FiberWaiter::List m_waiters;
+    bool m_writing = false;
+    int m_error = 0;
+
+    //written under m_mutex, atomic for the getters.
+    std::atomic<bool> m_closed = {false};
+    std::atomic<size_t> m_queued = {0};
+    std::atomic<size_t> m_peak_queued = {0};
+    std::atomic<uint64_t> m_sent = {0};
+    std::atomic<uint64_t> m_parks = {0};
+};
+
+} // namespace qff
+
+#endif
@@ -0,0 +1,98 @@
+#include "log.h"
+#include "io_manager.h"
+#include "hook.h"
+#include "clock.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <atomic>
+#include <iostream>
+
+using namespace qff;
+
+static std::atomic<uint64_t> s_alloc_count = {0};
+
+void* operator new(size_t size) {
+    ++s_alloc_count;
+    void* p = ::malloc(size);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    ::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    ::free(p);
+}
+
+static const int ROUNDS = 200000;
+
+static void Report(const char* name, uint64_t start_us, uint64_t start_allocs, int ops) {
+    uint64_t us = GetMonotonicUS() - start_us;
+    uint64_t allocs = s_alloc_count - start_allocs;
+    std::cout << name << ": " << us * 1000.0 / ops << " ns/op, "
+        << (double)allocs / ops << " allocs/op" << std::endl;
+}
+
+//data is always ready, every call takes the non-blocking path.
+static void bench_ready(int fds[2]) {
+    set_hook_enable(true);
+    char buf[64] = {0};
+    uint64_t start_allocs = s_alloc_count;
+    uint64_t start_us = GetMonotonicUS();
+    for(int i = 0; i < ROUNDS; ++i) {
+        ::send(fds[0], buf, sizeof(buf), 0);
+        ::recv(fds[1], buf, sizeof(buf), 0);
+    }
+    Report("ready send+recv", start_us, start_allocs, ROUNDS * 2);
+}
+
+//two fibers ping-pong, every recv parks on the event with a timeout armed.
+static void bench_pingpong(int fds[2]) {
+    set_hook_enable(true);
+    timeval tv = {5, 0};
+    ::setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(fds[1], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    IOManager::GetThis()->schedule([fds]{
+        set_hook_enable(true);
+        char buf[64];
+        for(int i = 0; i < ROUNDS; ++i) {
+            if(::recv(fds[1], buf, sizeof(buf), 0) <= 0)
+                break;
+            ::send(fds[1], buf, sizeof(buf), 0);
+        }
+    });
+
+    char buf[64] = {0};
+    uint64_t start_allocs = s_alloc_count;
+    uint64_t start_us = GetMonotonicUS();
+    for(int i = 0; i < ROUNDS; ++i) {
+        ::send(fds[0], buf, sizeof(buf), 0);
+        ::recv(fds[0], buf, sizeof(buf), 0);
+    }
+    Report("ping-pong round trip", start_us, start_allocs, ROUNDS);
+}
+
+int main() {
+    LoggerMgr::New();
+    int fds[2];
+    if(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        std::cout << "socketpair error" << std::endl;
+        return 1;
+    }
+    {
+        IOManager iom(1, "bench", false);
+        iom.schedule([&fds]{
+            bench_ready(fds);
+            bench_pingpong(fds);
+        });
+    }
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return 0;
+}
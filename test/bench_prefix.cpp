@@ -0,0 +1,170 @@
+#include "log.h"
+#include "prefix_table.h"
+#include "clock.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <array>
+#include <unordered_map>
+#include <iostream>
+
+using namespace qff;
+
+static const int PREFIXES = 1000000;
+static const int V6_PREFIXES = 200000;
+static const int LOOKUPS = 4000000;
+
+//roughly the shape of a bgp table, most routes are /24.
+static int PickLength(std::mt19937& rng) {
+    int r = rng() % 100;
+    if(r < 60)
+        return 24;
+    if(r < 90)
+        return 16 + rng() % 8;
+    return 25 + rng() % 8;
+}
+
+static uint32_t Mask(int len) {
+    return len ? ~0u << (32 - len) : 0;
+}
+
+static void Report(const char* name, uint64_t start_us, int ops, uint64_t hits) {
+    uint64_t us = GetMonotonicUS() - start_us;
+    std::cout << name << ": " << ops / (double)us << " M lookups/s, "
+        << us * 1000.0 / ops << " ns/lookup, " << hits * 100.0 / ops << "% matched" << std::endl;
+}
+
+//half the keys fall inside a loaded prefix, half are random.
+static std::vector<uint32_t> MakeKeys(std::mt19937& rng, const std::vector<std::pair<uint32_t, int>>& prefixes) {
+    std::vector<uint32_t> keys(LOOKUPS);
+    for(auto& i : keys) {
+        if(rng() & 1) {
+            auto& p = prefixes[rng() % prefixes.size()];
+            i = p.first | (rng() & ~Mask(p.second));
+        } else {
+            i = rng();
+        }
+    }
+    return keys;
+}
+
+//the usual fallback, one hash probe per prefix length from /32 down.
+static void bench_hash(const std::vector<std::pair<uint32_t, int>>& prefixes,
+                       const std::vector<uint32_t>& keys) {
+    std::unordered_map<uint32_t, uint32_t> by_len[33];
+    for(size_t i = 0; i < prefixes.size(); ++i)
+        by_len[prefixes[i].second][prefixes[i].first] = i;
+    uint64_t hits = 0;
+    uint64_t start_us = GetMonotonicUS();
+    for(auto key : keys) {
+        for(int len = 32; len >= 0; --len) {
+            auto& map = by_len[len];
+            if(map.empty())
+                continue;
+            if(map.find(key & Mask(len)) != map.end()) {
+                ++hits;
+                break;
+            }
+        }
+    }
+    Report("per-length hash", start_us, keys.size(), hits);
+}
+
+static void bench_v4(PrefixTable& table, const std::vector<uint32_t>& keys) {
+    uint64_t hits = 0;
+    uint64_t start_us = GetMonotonicUS();
+    PrefixTable::Value value;
+    for(auto key : keys)
+        hits += table.lookup_v4(key, value);
+    Report("PrefixTable v4", start_us, keys.size(), hits);
+}
+
+static void bench_v6(std::mt19937& rng) {
+    PrefixTable::Builder builder;
+    std::vector<std::array<uint8_t, 16>> networks;
+    for(int i = 0; i < V6_PREFIXES; ++i) {
+        //2000::/3 global unicast, /32 to /48 allocations.
+        std::array<uint8_t, 16> addr = {};
+        uint32_t top = 0x20000000 | (rng() & 0x1fffffff);
+        uint32_t next = rng();
+        memcpy(addr.data(), &(top = htonl(top)), 4);
+        memcpy(addr.data() + 4, &(next = htonl(next)), 4);
+        sockaddr_in6 sa = {};
+        sa.sin6_family = AF_INET6;
+        memcpy(&sa.sin6_addr, addr.data(), 16);
+        builder.add(SockAddr((sockaddr*)&sa, sizeof(sa)), 32 + rng() % 17, i);
+        networks.push_back(addr);
+    }
+    PrefixTable table;
+    uint64_t start_us = GetMonotonicUS();
+    table.load(builder);
+    std::cout << "v6 load of " << table.get_count() << " prefixes: "
+        << (GetMonotonicUS() - start_us) / 1000 << " ms, "
+        << table.get_memory() / (1024 * 1024) << " MB" << std::endl;
+
+    int lookups = LOOKUPS / 4;
+    std::vector<std::array<uint8_t, 16>> keys(lookups);
+    for(auto& i : keys) {
+        i = networks[rng() % networks.size()];
+        for(int j = 6; j < 16; ++j)
+            i[j] = rng();
+    }
+    uint64_t hits = 0;
+    PrefixTable::Value value;
+    start_us = GetMonotonicUS();
+    for(auto& i : keys)
+        hits += table.lookup_v6(i.data(), value);
+    Report("PrefixTable v6", start_us, lookups, hits);
+}
+
+//lookups keep going while another thread reloads the table over and over.
+static void bench_reload(PrefixTable& table, const PrefixTable::Builder& builder,
+                         const std::vector<uint32_t>& keys) {
+    std::atomic<bool> stop = {false};
+    std::atomic<int> reloads = {0};
+    std::thread reloader([&]{
+        while(!stop) {
+            table.load(builder);
+            ++reloads;
+        }
+    });
+    uint64_t hits = 0;
+    uint64_t start_us = GetMonotonicUS();
+    PrefixTable::Value value;
+    for(auto key : keys)
+        hits += table.lookup_v4(key, value);
+    Report("PrefixTable v4 during reloads", start_us, keys.size(), hits);
+    stop = true;
+    reloader.join();
+    std::cout << reloads << " reloads finished meanwhile" << std::endl;
+}
+
+int main() {
+    LoggerMgr::New();
+    std::mt19937 rng(42);
+    std::vector<std::pair<uint32_t, int>> prefixes;
+    PrefixTable::Builder builder;
+    for(int i = 0; i < PREFIXES; ++i) {
+        int len = PickLength(rng);
+        uint32_t network = rng() & Mask(len);
+        prefixes.push_back({network, len});
+        builder.add(SockAddr::FromIPv4(network, 0), len, i);
+    }
+
+    PrefixTable table;
+    uint64_t start_us = GetMonotonicUS();
+    table.load(builder);
+    std::cout << "v4 load of " << table.get_count() << " prefixes: "
+        << (GetMonotonicUS() - start_us) / 1000 << " ms, "
+        << table.get_memory() / (1024 * 1024) << " MB" << std::endl;
+
+    std::vector<uint32_t> keys = MakeKeys(rng, prefixes);
+    bench_v4(table, keys);
+    bench_hash(prefixes, keys);
+    bench_v6(rng);
+    bench_reload(table, builder, keys);
+    return 0;
+}
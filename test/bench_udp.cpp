@@ -0,0 +1,171 @@
+#include "log.h"
+#include "io_manager.h"
+#include "hook.h"
+#include "socket.h"
+#include "fd_manager.h"
+#include "clock.h"
+
+#include <sys/socket.h>
+#include <sched.h>
+#include <atomic>
+#include <iostream>
+
+using namespace qff;
+
+static const int DATAGRAMS = 200000;
+static const int BURST = 32;
+//datagrams the producer may have in flight, keeps loopback from dropping.
+static const int WINDOW = 1024;
+static const size_t PAYLOAD = 64;
+
+struct BenchResult {
+    std::atomic<int> received = {0};
+    std::atomic<bool> done = {false};
+    uint64_t end_us = 0;
+};
+
+static Socket::ptr MakeReceiver() {
+    Socket::ptr sock = std::make_shared<Socket>(AF_INET, Socket::UDP);
+    sock->bind(IPAddress::Create("127.0.0.1", 0));
+    sock->set_option(SOL_SOCKET, SO_RCVBUF, 4 * 1024 * 1024);
+    //a lost datagram ends the run instead of hanging it.
+    sock->set_recv_timeout(200);
+    //this thread does not hook close, the fd may carry the previous run's counters.
+    FdContext::ptr ctx = FdMgr::Get()->add_or_get_fdctx(sock->get_socket());
+    if(ctx)
+        ctx->stats.reset();
+    return sock;
+}
+
+static void WaitWindow(const BenchResult& result, int sent) {
+    while(sent - result.received.load(std::memory_order_relaxed) > WINDOW && !result.done)
+        ::sched_yield();
+}
+
+static void Report(const char* name, const BenchResult& result, uint64_t start_us, int fd) {
+    uint64_t us = result.end_us - start_us;
+    int received = result.received;
+    FdContext::ptr ctx = FdMgr::Get()->add_or_get_fdctx(fd);
+    uint64_t syscalls = ctx ? ctx->stats.syscalls.load() : 0;
+    uint64_t parks = ctx ? ctx->stats.parks.load() : 0;
+    std::cout << name << ": " << received * 1000000.0 / us << " pps, "
+        << received << "/" << DATAGRAMS << " received, "
+        << (double)syscalls / std::max(received, 1) << " recv syscalls/datagram, "
+        << (double)parks / std::max(received, 1) << " parks/datagram" << std::endl;
+}
+
+//the receiver fiber does one hooked recvfrom per datagram, the producer one sendto.
+static void bench_single(IOManager& iom) {
+    Socket::ptr receiver = MakeReceiver();
+    Address::ptr to = receiver->get_local_address();
+    int rfd = receiver->get_socket();
+    BenchResult result;
+
+    iom.schedule([rfd, &result]{
+        set_hook_enable(true);
+        char buf[2048];
+        while(result.received < DATAGRAMS) {
+            if(::recvfrom(rfd, buf, sizeof(buf), 0, nullptr, nullptr) <= 0)
+                break;
+            result.received.fetch_add(1, std::memory_order_relaxed);
+        }
+        result.end_us = GetMonotonicUS();
+        result.done = true;
+    });
+
+    int sfd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    char payload[PAYLOAD] = {0};
+    uint64_t start_us = GetMonotonicUS();
+    for(int sent = 0; sent < DATAGRAMS && !result.done; sent += BURST) {
+        WaitWindow(result, sent);
+        for(int j = 0; j < BURST; ++j)
+            ::sendto(sfd, payload, sizeof(payload), 0, to->get_addr(), to->get_addr_len());
+    }
+    while(!result.done)
+        ::sched_yield();
+    Report("sendto/recvfrom", result, start_us, rfd);
+    ::close(sfd);
+}
+
+//the receiver fiber drains up to 64 datagrams per recv_batch, the producer
+//sends each burst with one send_batch.
+static void bench_batch(IOManager& iom) {
+    Socket::ptr receiver = MakeReceiver();
+    Address::ptr to = receiver->get_local_address();
+    int rfd = receiver->get_socket();
+    BenchResult result;
+
+    iom.schedule([receiver, &result]{
+        set_hook_enable(true);
+        DatagramBatch batch(64);
+        while(result.received < DATAGRAMS) {
+            int rt = receiver->recv_batch(batch);
+            if(rt <= 0)
+                break;
+            result.received.fetch_add(rt, std::memory_order_relaxed);
+        }
+        result.end_us = GetMonotonicUS();
+        result.done = true;
+    });
+
+    Socket sender(AF_INET, Socket::UDP);
+    sender.connect(to);
+    char payload[PAYLOAD] = {0};
+    DatagramBatch batch(BURST, PAYLOAD);
+    uint64_t start_us = GetMonotonicUS();
+    for(int sent = 0; sent < DATAGRAMS && !result.done; sent += BURST) {
+        WaitWindow(result, sent);
+        batch.clear();
+        for(int j = 0; j < BURST; ++j)
+            batch.push(payload, sizeof(payload));
+        sender.send_batch(batch);
+    }
+    while(!result.done)
+        ::sched_yield();
+    Report("send_batch/recv_batch", result, start_us, rfd);
+}
+
+//the producer sends each burst as one UDP_SEGMENT sendmsg and the receiver
+//reads coalesced UDP_GRO buffers that recv_batch splits.
+static void bench_gso(IOManager& iom) {
+    Socket::ptr receiver = MakeReceiver();
+    if(receiver->enable_gro())
+        std::cout << "UDP_GRO not supported, receiving without it" << std::endl;
+    Address::ptr to = receiver->get_local_address();
+    int rfd = receiver->get_socket();
+    BenchResult result;
+
+    iom.schedule([receiver, &result]{
+        set_hook_enable(true);
+        DatagramBatch batch(8, 64 * 1024);
+        while(result.received < DATAGRAMS) {
+            int rt = receiver->recv_batch(batch);
+            if(rt <= 0)
+                break;
+            result.received.fetch_add(rt, std::memory_order_relaxed);
+        }
+        result.end_us = GetMonotonicUS();
+        result.done = true;
+    });
+
+    Socket sender(AF_INET, Socket::UDP);
+    sender.connect(to);
+    char payload[PAYLOAD * BURST] = {0};
+    uint64_t start_us = GetMonotonicUS();
+    for(int sent = 0; sent < DATAGRAMS && !result.done; sent += BURST) {
+        WaitWindow(result, sent);
+        sender.send_segmented(payload, sizeof(payload), PAYLOAD);
+    }
+    while(!result.done)
+        ::sched_yield();
+    Report("send_segmented/recv_batch+gro", result, start_us, rfd);
+}
+
+int main() {
+    LoggerMgr::New();
+    IOManager iom(1, "bench", false);
+    bench_single(iom);
+    bench_batch(iom);
+    bench_gso(iom);
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include "log.h"
+#include "io_manager.h"
+#include "hook.h"
+#include "clock.h"
+#include "connection_pool.h"
+
+#include <unistd.h>
+#include <atomic>
+
+using namespace qff;
+
+static int s_failed = 0;
+
+#define CHECK(cond) \
+    if(!(cond)) { \
+        ++s_failed; \
+        QFF_LOG_ERROR(QFF_LOG_ROOT) << "check failed: " #cond; \
+    }
+
+//a checkout that parks in its own fiber, done is set once it returned.
+struct Checkout {
+    Socket::ptr sock;
+    int error = 0;
+    std::atomic<bool> done = {false};
+};
+
+static void park_checkout(ConnectionPool::ptr pool, Address::ptr addr, Checkout* result) {
+    set_hook_enable(true);
+    result->sock = pool->checkout(addr);
+    result->error = errno;
+    result->done = true;
+}
+
+static void wait_done(Checkout& result) {
+    for(int i = 0; i < 1000 && !result.done; ++i)
+        ::usleep(1000);
+}
+
+static void test_pool(Address::ptr addr) {
+    set_hook_enable(true);
+    ConnectionPool::Options options;
+    options.max_active = 2;
+    options.max_idle = 2;
+    options.idle_timeout_ms = 0;
+    options.wait_timeout_ms = 100;
+    auto pool = std::make_shared<ConnectionPool>(IOManager::GetThis(), options);
+
+    Socket::ptr a = pool->checkout(addr);
+    Socket::ptr b = pool->checkout(addr);
+    CHECK(a && b);
+    auto metrics = pool->get_metrics();
+    CHECK(metrics.misses == 2);
+    CHECK(metrics.active == 2);
+
+    //the host is exhausted, the third checkout waits out its timeout.
+    uint64_t start = GetMonotonicMS();
+    Socket::ptr c = pool->checkout(addr);
+    uint64_t waited = GetMonotonicMS() - start;
+    CHECK(!c);
+    CHECK(errno == ETIMEDOUT);
+    CHECK(waited >= 90);
+    metrics = pool->get_metrics();
+    CHECK(metrics.waits == 1);
+    CHECK(metrics.wait_timeouts == 1);
+    CHECK(metrics.active == 2);
+    QFF_LOG_INFO(QFF_LOG_ROOT) << "exhausted checkout waited " << waited << "ms";
+
+    //a checkin hands the connection itself to the parked checkout.
+    Checkout handed;
+    IOManager::GetThis()->schedule(std::bind(park_checkout, pool, addr, &handed));
+    ::usleep(20 * 1000);
+    CHECK(!handed.done);
+    pool->checkin(a);
+    wait_done(handed);
+    CHECK(handed.done);
+    CHECK(handed.sock == a);
+    metrics = pool->get_metrics();
+    CHECK(metrics.waits == 2);
+    CHECK(metrics.wait_timeouts == 1);
+    CHECK(metrics.hits == 1);
+    CHECK(metrics.active == 2);
+    CHECK(metrics.idle == 0);
+
+    //a broken checkin hands over its slot, the waiter connects anew.
+    Checkout slot;
+    IOManager::GetThis()->schedule(std::bind(park_checkout, pool, addr, &slot));
+    ::usleep(20 * 1000);
+    CHECK(!slot.done);
+    pool->checkin(b, true);
+    wait_done(slot);
+    CHECK(slot.done);
+    CHECK(slot.sock && slot.sock != b);
+    CHECK(!b->is_connected());
+    metrics = pool->get_metrics();
+    CHECK(metrics.misses == 3);
+    CHECK(metrics.active == 2);
+
+    //with nobody waiting the connections go idle and are reused.
+    if(handed.sock)
+        pool->checkin(handed.sock);
+    if(slot.sock)
+        pool->checkin(slot.sock);
+    metrics = pool->get_metrics();
+    CHECK(metrics.active == 0);
+    CHECK(metrics.idle == 2);
+    Socket::ptr d = pool->checkout(addr);
+    CHECK(d && d == slot.sock);
+    CHECK(pool->get_metrics().hits == 2);
+    if(d)
+        pool->checkin(d);
+    CHECK(pool->get_wait_histogram().get_count() == 3);
+
+    QFF_LOG_INFO(QFF_LOG_ROOT) << (s_failed ? "test_connection_pool FAILED" : "test_connection_pool passed");
+}
+
+int main() {
+    LoggerMgr::New();
+    //connects complete in the backlog, nothing has to accept them.
+    auto server = std::make_shared<Socket>(AF_INET, Socket::TCP);
+    CHECK(server->bind(IPAddress::Create("127.0.0.1", 0)) == 0);
+    CHECK(server->listen(16));
+    Address::ptr addr = server->get_local_address();
+
+    {
+        IOManager iom(1, "pool", false);
+        iom.schedule(std::bind(test_pool, addr));
+    }
+    server->close();
+    return s_failed ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+#include "log.h"
+#include "io_manager.h"
+#include "hook.h"
+#include "dns.h"
+#include "clock.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fstream>
+#include <atomic>
+
+using namespace qff;
+
+static std::atomic<int> s_queries = {0};
+static std::atomic<int> s_edns_queries = {0};
+static int s_failed = 0;
+
+#define CHECK(cond) \
+    if(!(cond)) { \
+        ++s_failed; \
+        QFF_LOG_ERROR(QFF_LOG_ROOT) << "check failed: " #cond; \
+    }
+
+static void PutU16(std::string& out, uint16_t v) {
+    out.push_back(v >> 8);
+    out.push_back(v & 0xff);
+}
+
+static void PutU32(std::string& out, uint32_t v) {
+    PutU16(out, v >> 16);
+    PutU16(out, v & 0xffff);
+}
+
+static void PutName(std::string& out, const std::string& name) {
+    size_t begin = 0;
+    while(begin < name.size()) {
+        size_t end = name.find('.', begin);
+        if(end == std::string::npos)
+            end = name.size();
+        out.push_back(end - begin);
+        out.append(name, begin, end - begin);
+        begin = end + 1;
+    }
+    out.push_back(0);
+}
+
+static void PutRecord(std::string& out, const std::string& owner, uint16_t type, uint32_t ttl, const std::string& rdata) {
+    PutName(out, owner);
+    PutU16(out, type);
+    PutU16(out, 1);
+    PutU32(out, ttl);
+    PutU16(out, rdata.size());
+    out += rdata;
+}
+
+//answers example.test, alias.test and the .test search suffix, ignores drop.test
+//and truncates big.test.
+static void stub_server(int sock) {
+    set_hook_enable(true);
+    char buf[512];
+    while(true) {
+        sockaddr_in from;
+        socklen_t len = sizeof(from);
+        int n = ::recvfrom(sock, buf, sizeof(buf), 0, (sockaddr*)&from, &len);
+        if(n < 12)
+            break;
+        ++s_queries;
+
+        std::string name;
+        size_t pos = 12;
+        while(pos < (size_t)n && buf[pos]) {
+            if(!name.empty())
+                name.push_back('.');
+            name.append(buf + pos + 1, buf[pos]);
+            pos += buf[pos] + 1;
+        }
+        uint16_t type = ((uint8_t)buf[pos + 1] << 8) | (uint8_t)buf[pos + 2];
+        //one additional opt record for the root advertising 1232 bytes.
+        if(buf[11] == 1 && pos + 16 <= (size_t)n && buf[pos + 5] == 0
+                && buf[pos + 7] == 41 && ((uint8_t)buf[pos + 8] << 8 | (uint8_t)buf[pos + 9]) == 1232)
+            ++s_edns_queries;
+        if(name == "drop.test")
+            continue;
+
+        std::string answers;
+        int count = 0;
+        std::string owner = name;
+        if(name == "alias.test") {
+            std::string target;
+            PutName(target, "example.test");
+            PutRecord(answers, name, DnsResolver::CNAME, 60, target);
+            ++count;
+            owner = "example.test";
+        }
+        if(owner == "example.test" || owner == "short.test") {
+            if(type == DnsResolver::A) {
+                PutRecord(answers, owner, DnsResolver::A, 1, std::string("\x0a\x00\x00\x01", 4));
+                PutRecord(answers, owner, DnsResolver::A, 60, std::string("\x0a\x00\x00\x02", 4));
+                count += 2;
+            } else if(type == DnsResolver::AAAA) {
+                std::string v6(16, '\0');
+                v6[15] = 1;
+                PutRecord(answers, owner, DnsResolver::AAAA, 60, v6);
+                ++count;
+            }
+        }
+
+        std::string out(buf, 2);
+        if(name == "big.test")
+            PutU16(out, 0x8380);
+        else
+            PutU16(out, count || owner == "example.test" ? 0x8180 : 0x8183);
+        PutU16(out, 1);
+        PutU16(out, count);
+        PutU16(out, 0);
+        PutU16(out, 0);
+        out.append(buf + 12, pos + 5 - 12);
+        out += answers;
+        ::sendto(sock, out.data(), out.size(), 0, (sockaddr*)&from, len);
+    }
+}
+
+static std::string Dump(const std::vector<IPAddress::ptr>& addrs) {
+    std::string rt;
+    for(auto& i : addrs)
+        rt += i->to_string() + " ";
+    return rt;
+}
+
+static void test_resolver(uint16_t port) {
+    set_hook_enable(true);
+    std::ofstream hosts("/tmp/qff_test_hosts");
+    hosts << "# comment\n192.168.1.7 fixed.test fixed\n::2 fixed.test\n";
+    hosts.close();
+
+    DnsResolver resolver;
+    resolver.add_nameserver(IPAddress::Create("127.0.0.1", port));
+    resolver.load_hosts("/tmp/qff_test_hosts");
+    resolver.set_search({"test"});
+    resolver.set_timeout(200);
+    resolver.set_attempts(1);
+
+    std::vector<IPAddress::ptr> addrs;
+    CHECK(resolver.resolve("example.test", AF_INET, addrs) == 0);
+    QFF_LOG_INFO(QFF_LOG_ROOT) << "example.test A: " << Dump(addrs);
+    CHECK(addrs.size() == 2);
+
+    int queries = s_queries;
+    addrs.clear();
+    CHECK(resolver.resolve("EXAMPLE.test.", AF_INET, addrs) == 0);
+    CHECK(addrs.size() == 2);
+    CHECK(s_queries == queries);
+
+    addrs.clear();
+    CHECK(resolver.resolve("example.test", AF_UNSPEC, addrs) == 0);
+    QFF_LOG_INFO(QFF_LOG_ROOT) << "example.test A+AAAA: " << Dump(addrs);
+    CHECK(addrs.size() == 3);
+
+    addrs.clear();
+    CHECK(resolver.resolve("alias.test", AF_INET, addrs) == 0);
+    QFF_LOG_INFO(QFF_LOG_ROOT) << "alias.test: " << Dump(addrs);
+    CHECK(addrs.size() == 2);
+
+    //single label names go through the search list.
+    addrs.clear();
+    CHECK(resolver.resolve("short", AF_INET, addrs) == 0);
+    QFF_LOG_INFO(QFF_LOG_ROOT) << "short: " << Dump(addrs);
+
+    addrs.clear();
+    CHECK(resolver.resolve("fixed", AF_UNSPEC, addrs) == 0);
+    QFF_LOG_INFO(QFF_LOG_ROOT) << "fixed (hosts): " << Dump(addrs);
+    CHECK(addrs.size() == 1);
+    addrs.clear();
+    CHECK(resolver.resolve("fixed.test", AF_UNSPEC, addrs) == 0);
+    CHECK(addrs.size() == 2);
+
+    //negative answers are cached as well.
+    CHECK(resolver.resolve("missing.test", AF_INET, addrs) == -1);
+    queries = s_queries;
+    CHECK(resolver.resolve("missing.test", AF_INET, addrs) == -1);
+    CHECK(s_queries == queries);
+
+    CHECK(s_edns_queries == s_queries);
+
+    //a truncated empty answer is a failure and not cached.
+    CHECK(resolver.resolve("big.test.", AF_INET, addrs) == -1);
+    queries = s_queries;
+    CHECK(resolver.resolve("big.test.", AF_INET, addrs) == -1);
+    CHECK(s_queries == queries + 1);
+
+    uint64_t start = GetMonotonicMS();
+    CHECK(resolver.resolve("drop.test", AF_INET, addrs) == -1);
+    QFF_LOG_INFO(QFF_LOG_ROOT) << "drop.test timed out after " << GetMonotonicMS() - start << "ms";
+
+    //the first A record has a ttl of one second.
+    queries = s_queries;
+    ::sleep(2);
+    addrs.clear();
+    CHECK(resolver.resolve("example.test", AF_INET, addrs) == 0);
+    CHECK(s_queries == queries + 1);
+
+    auto lookup = Address::Lookup("localhost:8080");
+    CHECK(!lookup.empty());
+    if(!lookup.empty())
+        QFF_LOG_INFO(QFF_LOG_ROOT) << "Address::Lookup(localhost:8080): " << *lookup[0];
+
+    //a runt datagram stops the stub server.
+    int sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    ::sendto(sock, "", 1, 0, (sockaddr*)&addr, sizeof(addr));
+    ::close(sock);
+    ::unlink("/tmp/qff_test_hosts");
+    QFF_LOG_INFO(QFF_LOG_ROOT) << (s_failed ? "test_dns FAILED" : "test_dns passed");
+}
+
+int main() {
+    LoggerMgr::New();
+    int sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(sock, (sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    ::getsockname(sock, (sockaddr*)&addr, &len);
+
+    {
+        IOManager iom(1, "dns", false);
+        iom.schedule(std::bind(stub_server, sock));
+        iom.schedule(std::bind(test_resolver, ntohs(addr.sin_port)));
+    }
+    ::close(sock);
+    return s_failed ? 1 : 0;
+}
@@ -8,6 +8,8 @@
 #include <iostream>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/socket.h>
+#include <atomic>
 
 using namespace qff;
 
@@ -24,7 +26,8 @@ void test() {
     ::connect(sock, (const sockaddr*)&addr, sizeof(sockaddr));
     char buf[4096] = "GET / HTTP/1.1\r\n"
                 "Host:www.baidu.com\r\n\r\n";
-    int rt = ::send(sock, buf, sizeof(buf), 0);
+    //offline the connect fails, no SIGPIPE for the send then.
+    int rt = ::send(sock, buf, sizeof(buf), MSG_NOSIGNAL);
     if(rt < 0)
          QFF_LOG_DEBUG(QFF_LOG_ROOT) << "?";
     rt = ::recv(sock, buf, 4096, 0);
@@ -52,8 +55,51 @@ void test3() {
     iom->schedule(test);
 }
 
+//a fiber first run on a given worker must come back to it after every park.
+bool test_affinity() {
+    static const int ROUNDS = 20;
+    IOManager iom(3, "affinity", false);
+    std::atomic<int> moved = {0};
+    std::atomic<int> parks = {0};
+    for(size_t i = 0; i < iom.get_thread_count(); ++i) {
+        int fds[2];
+        ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        pid_t thread_id = iom.get_thread_id(i);
+        iom.schedule([fds, thread_id, &moved, &parks]{
+            set_hook_enable(true);
+            char c;
+            for(int j = 0; j < ROUNDS; ++j) {
+                //one park on the event, one on a timer.
+                if(::recv(fds[0], &c, 1, 0) != 1)
+                    break;
+                ::usleep(100);
+                parks += 2;
+                if(GetThreadId() != thread_id)
+                    ++moved;
+            }
+            ::close(fds[0]);
+        }, thread_id);
+        iom.schedule([fds]{
+            set_hook_enable(true);
+            for(int j = 0; j < ROUNDS; ++j) {
+                ::usleep(1000);
+                ::send(fds[1], "x", 1, 0);
+            }
+            ::close(fds[1]);
+        });
+    }
+    iom.stop();
+    QFF_LOG_INFO(QFF_LOG_ROOT) << "affinity: " << moved << " of " << parks
+        << " parks resumed on another worker";
+    return moved == 0 && parks == ROUNDS * 2 * (int)iom.get_thread_count();
+}
+
 int main() {
     LoggerMgr::New();
+    if(!test_affinity()) {
+        QFF_LOG_ERROR(QFF_LOG_ROOT) << "test_affinity failed";
+        return 1;
+    }
     test3();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "log.h"
+#include "io_manager.h"
+#include "hook.h"
+#include "clock.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+using namespace qff;
+
+static int s_failed = 0;
+
+#define CHECK(cond) \
+    if(!(cond)) { \
+        ++s_failed; \
+        QFF_LOG_ERROR(QFF_LOG_ROOT) << "check failed: " #cond; \
+    }
+
+//deadlines in us on every level of the wheel: level 0 holds 256us,
+//each level above 64 times more, the last ones cascade down twice.
+static const uint64_t DEADLINES[] = {
+    1100 * 1000, 90, 300, 17 * 1000, 255, 2000, 1050 * 1000, 16 * 1000,
+    20, 600 * 1000, 5000, 257, 70 * 1000, 1, 16385, 1200 * 1000
+};
+static const size_t COUNT = sizeof(DEADLINES) / sizeof(DEADLINES[0]);
+
+static void test_ordering() {
+    set_hook_enable(true);
+    IOManager* iom = IOManager::GetThis();
+    std::vector<size_t> fired;
+    std::vector<uint64_t> elapsed(COUNT);
+    uint64_t start = GetMonotonicUS();
+    for(size_t i = 0; i < COUNT; ++i) {
+        iom->add_timer_us(DEADLINES[i], [i, start, &fired, &elapsed]{
+            fired.push_back(i);
+            elapsed[i] = GetMonotonicUS() - start;
+        });
+    }
+    for(int i = 0; i < 200 && fired.size() < COUNT; ++i)
+        ::usleep(10 * 1000);
+
+    CHECK(fired.size() == COUNT);
+    for(size_t i = 1; i < fired.size(); ++i) {
+        if(DEADLINES[fired[i - 1]] > DEADLINES[fired[i]]) {
+            ++s_failed;
+            QFF_LOG_ERROR(QFF_LOG_ROOT) << "timer of " << DEADLINES[fired[i]]
+                << "us fired after the one of " << DEADLINES[fired[i - 1]] << "us";
+        }
+    }
+    //the deadlines count from the loop's cached clock, a little before start.
+    for(auto i : fired) {
+        if(elapsed[i] + 1000 < DEADLINES[i]) {
+            ++s_failed;
+            QFF_LOG_ERROR(QFF_LOG_ROOT) << "timer of " << DEADLINES[i]
+                << "us fired after " << elapsed[i] << "us";
+        }
+    }
+}
+
+//a fired or cancelled slab timer is recycled, its old handle must not reach
+//the timer that takes the node next.
+static void test_stale_handle() {
+    IOManager* iom = IOManager::GetThis();
+    int fired[4] = {0};
+    TimerHandle second;
+    //the node is back on the free list when the callback runs, the next timer takes it.
+    TimerHandle first = iom->add_timer_handle(5, [iom, &fired, &second]{
+        ++fired[0];
+        second = iom->add_timer_handle(30, [&fired]{ ++fired[1]; });
+    });
+    ::usleep(10 * 1000);
+    CHECK(fired[0] == 1);
+    CHECK(first.cancel() == -1);
+    CHECK(first.refresh() == -1);
+    CHECK(first.reset(1, true) == -1);
+
+    TimerHandle third = iom->add_timer_handle(10, [&fired]{ ++fired[2]; });
+    CHECK(third.cancel() == 0);
+    CHECK(third.cancel() == -1);
+    TimerHandle fourth = iom->add_timer_handle(60, [&fired]{ ++fired[3]; });
+    CHECK(third.cancel() == -1);
+    CHECK(third.refresh() == -1);
+    CHECK(third.reset(1, true) == -1);
+
+    ::usleep(10 * 1000);
+    CHECK(fired[1] == 0);
+    CHECK(fired[3] == 0);
+    //a live handle still moves its timer.
+    CHECK(fourth.refresh() == 0);
+    ::usleep(30 * 1000);
+    CHECK(fired[1] == 1);
+    CHECK(fired[3] == 0);
+    ::usleep(60 * 1000);
+    CHECK(fired[2] == 0);
+    CHECK(fired[3] == 1);
+    CHECK(second.cancel() == -1);
+    CHECK(fourth.refresh() == -1);
+}
+
+static void test_timer() {
+    test_ordering();
+    test_stale_handle();
+    QFF_LOG_INFO(QFF_LOG_ROOT) << (s_failed ? "test_timer FAILED" : "test_timer passed");
+}
+
+int main() {
+    LoggerMgr::New();
+    {
+        IOManager iom(1, "timer", false);
+        iom.schedule(test_timer);
+    }
+    return s_failed ? 1 : 0;
+}
@@ -0,0 +1,127 @@
+#include "log.h"
+#include "io_manager.h"
+#include "hook.h"
+#include "write_queue.h"
+
+#include <unistd.h>
+#include <atomic>
+
+using namespace qff;
+
+static const size_t CHUNK = 16 * 1024;
+static const size_t HIGH_WATERMARK = 64 * 1024;
+static const size_t LOW_WATERMARK = 16 * 1024;
+
+static int s_failed = 0;
+
+#define CHECK(cond) \
+    if(!(cond)) { \
+        ++s_failed; \
+        QFF_LOG_ERROR(QFF_LOG_ROOT) << "check failed: " #cond; \
+    }
+
+//a write that may park in its own fiber, done is set once it returned.
+struct Write {
+    int rt = 0;
+    int error = 0;
+    uint64_t sent = 0;
+    std::atomic<bool> done = {false};
+};
+
+static void park_write(WriteQueue::ptr queue, Write* result) {
+    set_hook_enable(true);
+    result->rt = queue->write(std::string(CHUNK, 'w'));
+    result->error = errno;
+    result->sent = queue->get_sent();
+    result->done = true;
+}
+
+//writes until the kernel buffers are full and a write times out on the high watermark.
+static bool fill(WriteQueue::ptr queue) {
+    std::string chunk(CHUNK, 'f');
+    for(int i = 0; i < 1000; ++i) {
+        if(queue->write(chunk.data(), chunk.size(), 50) == -1)
+            return errno == ETIMEDOUT;
+    }
+    return false;
+}
+
+static void test_queue() {
+    set_hook_enable(true);
+    //small buffers so the kernel side fills up after a few chunks, bind creates the fds.
+    auto server = std::make_shared<Socket>(AF_INET, Socket::TCP);
+    CHECK(server->bind(IPAddress::Create("127.0.0.1", 0)) == 0);
+    CHECK(server->set_option(SOL_SOCKET, SO_RCVBUF, 4096) == 0);
+    CHECK(server->listen(16));
+    auto client = std::make_shared<Socket>(AF_INET, Socket::TCP);
+    CHECK(client->bind(IPAddress::Create("127.0.0.1", 0)) == 0);
+    CHECK(client->set_option(SOL_SOCKET, SO_SNDBUF, 4096) == 0);
+    CHECK(client->connect(server->get_local_address()) == 0);
+    Socket::ptr peer = server->accept();
+    CHECK(peer);
+    if(!peer)
+        return;
+
+    auto queue = std::make_shared<WriteQueue>(IOManager::GetThis(), client,
+                                              HIGH_WATERMARK, LOW_WATERMARK, 1024 * 1024);
+    //a write only parks once more than the high watermark is queued.
+    CHECK(fill(queue));
+    size_t queued = queue->get_queued();
+    CHECK(queued > HIGH_WATERMARK);
+    CHECK(queued <= HIGH_WATERMARK + CHUNK);
+    uint64_t parks = queue->get_parks();
+    CHECK(parks >= 1);
+    QFF_LOG_INFO(QFF_LOG_ROOT) << "full at " << queued << " queued, " << queue->get_sent() << " sent";
+
+    //the parked write resumes only once the queue fell to the low watermark.
+    Write parked;
+    IOManager::GetThis()->schedule(std::bind(park_write, queue, &parked));
+    ::usleep(20 * 1000);
+    CHECK(!parked.done);
+    CHECK(queue->get_parks() == parks + 1);
+    queued = queue->get_queued();
+    uint64_t sent = queue->get_sent();
+    char buffer[4096];
+    for(int i = 0; i < 1000 && !parked.done; ++i) {
+        CHECK(peer->recv(buffer, sizeof(buffer)) > 0);
+        ::usleep(1000);
+    }
+    CHECK(parked.done);
+    CHECK(parked.rt == (int)CHUNK);
+    //nothing else was queued meanwhile, so at least this much had to be sent.
+    CHECK(parked.sent - sent >= queued - LOW_WATERMARK);
+
+    //close fails every parked write and drops what is queued.
+    CHECK(fill(queue));
+    Write first;
+    Write second;
+    IOManager::GetThis()->schedule(std::bind(park_write, queue, &first));
+    IOManager::GetThis()->schedule(std::bind(park_write, queue, &second));
+    ::usleep(20 * 1000);
+    CHECK(!first.done && !second.done);
+    queue->close();
+    for(int i = 0; i < 1000 && !(first.done && second.done); ++i)
+        ::usleep(1000);
+    CHECK(first.done && first.rt == -1 && first.error == EPIPE);
+    CHECK(second.done && second.rt == -1 && second.error == EPIPE);
+    CHECK(queue->is_closed());
+    ::usleep(20 * 1000);
+    CHECK(queue->get_queued() == 0);
+    CHECK(WriteQueue::GetTotalQueued() == 0);
+    CHECK(queue->write("x", 1) == -1 && errno == EPIPE);
+    CHECK(queue->flush(0) == -1);
+    peer->close();
+    client->close();
+    server->close();
+
+    QFF_LOG_INFO(QFF_LOG_ROOT) << (s_failed ? "test_write_queue FAILED" : "test_write_queue passed");
+}
+
+int main() {
+    LoggerMgr::New();
+    {
+        IOManager iom(1, "write_queue", false);
+        iom.schedule(test_queue);
+    }
+    return s_failed ? 1 : 0;
+}